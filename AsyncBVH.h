@@ -0,0 +1,139 @@
+#ifndef ASYNC_BVH_H
+#define ASYNC_BVH_H
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "ParticleSystem.h"
+#include "ParticleKernels.h"
+#include "BVH.h"
+#include "FrameArena.h"
+
+// Double-buffered BVH whose rebuild runs on a worker thread, off the critical path of a step.
+// While step k queries the front tree, the worker builds the back tree from the positions
+// predicted for step k + 1. At the start of step k + 1 the trees swap, and the new front tree
+// is refit to the actual positions: the topology comes from the prediction, but the bounds
+// are exact, so queries return the same results as a freshly built tree.
+
+class AsyncBVH {
+public:
+    AsyncBVH() : front(0), buildPending(false), backReady(false), stopping(false) {
+        worker = std::thread([this]() { workerLoop(); });
+    }
+
+    ~AsyncBVH() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+
+    AsyncBVH(const AsyncBVH&) = delete;
+    AsyncBVH& operator=(const AsyncBVH&) = delete;
+
+    // Applies the same settings to both trees, e.g. [](BVH& tree) { tree.strategy = BuildStrategy::LBVH; }.
+    // Trees built with the old settings are not reused, so call build() afterwards.
+    template <typename Fn>
+    void configure(Fn&& fn) {
+        waitForBuild();
+        backReady = false;
+        fn(trees[0]);
+        fn(trees[1]);
+    }
+
+    // Tree for the current step
+    const BVH& current() const {
+        return trees[front];
+    }
+
+    // Builds the front tree in place and starts building the next one from the same positions
+    void build(const ParticleSystem& particles) {
+        waitForBuild();
+        backReady = false;
+        trees[front].build(particles);
+        startBuild(particles, 0.0f);
+    }
+
+    void updateParticles(ParticleSystem& particles, float deltaTime) {
+        integrateParticles(particles, deltaTime);
+
+        waitForBuild();
+        if (backReady) {
+            front = 1 - front;
+            backReady = false;
+        }
+        // The next step swaps in a tree built for it, so a refit that degraded the tree is kept
+        // rather than rebuilt synchronously. Without the quality check, refit only fails if the
+        // particle count changed since the snapshot.
+        if (!trees[front].refit(particles, false)) {
+            trees[front].build(particles);
+        }
+        startBuild(particles, deltaTime);
+    }
+
+    template <typename Visitor>
+    void query(const AABB& queryBounds, Visitor&& visitor) const {
+        trees[front].query(queryBounds, visitor);
+    }
+
+    void findOverlappingPairs(std::vector<std::pair<int, int>>& pairs) {
+        trees[front].findOverlappingPairs(pairs);
+    }
+
+private:
+    BVH trees[2];
+    int front;
+    ParticleSystem snapshot; // Predicted positions the back tree is built from, the other columns are unused
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;     // A build was requested or the worker has to stop
+    std::condition_variable finished; // The requested build is done
+    bool buildPending;
+    bool backReady;
+    bool stopping;
+
+    // Snapshots the particles moved ahead by deltaTime and hands them to the worker.
+    // Neither the snapshot nor the back tree is touched again until waitForBuild returns.
+    void startBuild(const ParticleSystem& particles, float deltaTime) {
+        snapshot.resize(particles.size());
+        for (size_t i = 0; i < particles.size(); ++i) {
+            snapshot.posX[i] = particles.posX[i] + particles.velX[i] * deltaTime;
+            snapshot.posY[i] = particles.posY[i] + particles.velY[i] * deltaTime;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            buildPending = true;
+        }
+        wake.notify_one();
+    }
+
+    void waitForBuild() {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this]() { return !buildPending; });
+    }
+
+    void workerLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this]() { return buildPending || stopping; });
+            if (stopping) {
+                return;
+            }
+            BVH& back = trees[1 - front];
+            lock.unlock();
+            back.build(snapshot);
+            // The build took its scratch from this thread's arena, which no step resets
+            threadFrameArena().reset();
+            lock.lock();
+            buildPending = false;
+            backReady = true;
+            finished.notify_one();
+        }
+    }
+};
+
+#endif
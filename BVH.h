@@ -3,6 +3,24 @@
 
 #include <limits>
 #include <algorithm>
+#include <vector>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <array>
+#include <cfloat>
+#include <cmath>
+#include "FrameArena.h"
+#include "Parallel.h"
+#include "ParticleSystem.h"
+#include "ParticleKernels.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 // Defining the structure of Axis-Aligned-Bounding-Box
 
@@ -32,156 +50,1437 @@ struct AABB {
     float area() const {
         return (maxX - minX) * (maxY - minY);
     }
+
+    // Computes the perimeter of the AABB, the surface area heuristic metric in 2D
+    float perimeter() const {
+        return 2.0f * ((maxX - minX) + (maxY - minY));
+    }
+
+    // Checks if this AABB fully contains another AABB
+    bool contains(const AABB& other) const {
+        return minX <= other.minX && minY <= other.minY &&
+               maxX >= other.maxX && maxY >= other.maxY;
+    }
+
+    // Squared distance from point to the closest point of the AABB, 0 inside
+    float distanceSquared(const glm::vec2& point) const {
+        float dx = std::max(std::max(minX - point.x, 0.0f), point.x - maxX);
+        float dy = std::max(std::max(minY - point.y, 0.0f), point.y - maxY);
+        return dx * dx + dy * dy;
+    }
+
+    // Slab test of the ray origin + t * direction for t in [0, tMax], with inverseDirection = 1 / direction.
+    // On a hit tEntry is where the ray enters the AABB, 0 if the origin lies inside.
+    bool intersectRay(const glm::vec2& origin, const glm::vec2& inverseDirection, float tMax, float& tEntry) const {
+        float tNear = 0.0f;
+        float tFar = tMax;
+        if (!clipSlab(origin.x, inverseDirection.x, minX, maxX, tNear, tFar) ||
+            !clipSlab(origin.y, inverseDirection.y, minY, maxY, tNear, tFar)) {
+            return false;
+        }
+        tEntry = tNear;
+        return true;
+    }
+
+    static bool clipSlab(float origin, float inverseDirection, float slabMin, float slabMax, float& tNear, float& tFar) {
+        if (std::isinf(inverseDirection)) {
+            // Parallel to the slab, the ray either stays inside it or never enters
+            return origin >= slabMin && origin <= slabMax;
+        }
+        float t0 = (slabMin - origin) * inverseDirection;
+        float t1 = (slabMax - origin) * inverseDirection;
+        if (t0 > t1) {
+            std::swap(t0, t1);
+        }
+        tNear = std::max(tNear, t0);
+        tFar = std::min(tFar, t1);
+        return tNear <= tFar;
+    }
 };
 
 
 // Defining the structure of BVH Node
+// Nodes live in a flat pool owned by the BVH, children are referenced by index
 
 struct BVHNode {
+    static constexpr uint32_t NullIndex = std::numeric_limits<uint32_t>::max();
+
     AABB bounds;
-    BVHNode* left;
-    BVHNode* right;
-    int particleIndex; // Index of the particle, -1 if not a leaf
+    uint32_t left;
+    uint32_t right;
+    uint32_t first; // First slot of a leaf in BVH::primIndices
+    uint32_t count; // Number of particles in a leaf, 0 for internal nodes
+    uint32_t parent; // NullIndex for the root
 
-    BVHNode() : left(nullptr), right(nullptr), particleIndex(-1) {}
+    BVHNode() : left(NullIndex), right(NullIndex), first(0), count(0), parent(NullIndex) {}
 
     bool isLeaf() const {
-        return particleIndex != -1;
+        return count != 0;
     }
 };
 
+// Node of the collapsed 4-ary tree. The boxes of the four children are stored lane by lane
+// so a single SSE compare tests all of them.
+struct alignas(16) BVH4Node {
+    static constexpr int32_t EmptyLane = std::numeric_limits<int32_t>::min();
+
+    float minX[4], minY[4], maxX[4], maxY[4];
+    int32_t child[4]; // >= 0: index of a BVH4Node, < 0: ~index of a binary leaf in BVH::nodes
+};
+
+// Compressed BVH4Node: child boxes are stored as 16-bit offsets from the node's own box,
+// always rounded outwards, so a node fits in one 64-byte cache line
+struct alignas(64) QBVH4Node {
+    float originX, originY; // Min corner of the node's box
+    float scaleX, scaleY;   // World size of one quantization step
+    uint16_t qMinX[4], qMinY[4], qMaxX[4], qMaxY[4];
+    int32_t child[4];       // Same encoding as BVH4Node::child
+};
+static_assert(sizeof(QBVH4Node) == 64, "QBVH4Node must fill exactly one cache line");
+
+// Available tree construction algorithms
+enum class BuildStrategy {
+    Median,    // Recursive median split along the longest axis
+    LBVH,      // Linear BVH from sorted Morton codes, built in parallel
+    BinnedSAH  // Surface area heuristic evaluated over centroid bins
+};
+
+// Node layout used by queries
+enum class NodeLayout {
+    Binary, // Walk the binary nodes directly
+    Wide4,     // Collapse the binary tree into BVH4Nodes after every build and refit
+    Quantized4 // As Wide4, then compress the wide nodes into QBVH4Nodes for queries
+};
+
 // Defining the BHV class
 
 class BVH {
 public:
-    BVHNode* root;
+    std::vector<BVHNode> nodes; // Node pool, reused across builds
+    uint32_t root;
+    BuildStrategy strategy;
+    NodeLayout layout; // Applied by the next build or refit, queries use the binary nodes until then
+
+    // Collapsed 4-ary tree, kept up to date for the Wide4 and Quantized4 layouts.
+    // quantizedNodes[i] is the compressed copy of wideNodes[i].
+    std::vector<BVH4Node> wideNodes;
+    std::vector<QBVH4Node> quantizedNodes;
+    uint32_t wideRoot;
+
+    // Leaves hold up to maxLeafSize particles. Leaf slot s refers to particle primIndices[s],
+    // and the slot boxes are stored as separate arrays so a leaf is tested with SIMD.
+    std::vector<uint32_t> primIndices;
+    std::vector<float> leafMinX, leafMinY, leafMaxX, leafMaxY;
+    int maxLeafSize;
+
+    // Leaf holding every particle, where queryNear starts. Refit keeps the topology, so the
+    // entries stay valid until the next build.
+    std::vector<uint32_t> particleLeaves;
+
+    static constexpr int QueryStackSize = 64;
+
+    // Refit instead of rebuilding while the summed internal node area stays
+    // below rebuildThreshold times the area right after the last build
+    bool refitEnabled;
+    float rebuildThreshold;
 
-    BVH() : root(nullptr) {}
+    // Binned SAH parameters: number of centroid bins per axis, cost of visiting an
+    // internal node and cost of testing one particle against a query
+    int sahBinCount;
+    float sahTraversalCost;
+    float sahLeafCost;
 
-    ~BVH() {
-        deleteTree(root);
+    BVH() : root(BVHNode::NullIndex), strategy(BuildStrategy::Median), layout(NodeLayout::Binary),
+            wideRoot(BVHNode::NullIndex), maxLeafSize(4),
+            refitEnabled(true), rebuildThreshold(1.5f),
+            sahBinCount(16), sahTraversalCost(1.0f), sahLeafCost(1.0f),
+            builtArea(0.0f), activeLayout(NodeLayout::Binary), buildFlagCapacity(0) {}
+
+    static AABB particleAABB(const glm::vec2& pos) {
+        return AABB(pos.x - 0.1f, pos.y - 0.1f, pos.x + 0.1f, pos.y + 0.1f);
     }
 
-    void build(std::vector<Particle>& particles) {
-        std::vector<AABB> particleBounds;
-        for (auto& particle : particles) {
-            particleBounds.push_back(AABB(
-                particle.getPosition().x - 0.1f, particle.getPosition().y - 0.1f,
-                particle.getPosition().x + 0.1f, particle.getPosition().y + 0.1f
-            ));
+    // Builds over an index permutation, particles themselves are never moved
+    void build(const ParticleSystem& particles) {
+        buildBinary(particles);
+        particleLeaves.resize(particles.size());
+        if (root != BVHNode::NullIndex) {
+            assignParticleLeaves(root);
         }
+        updateLayout(true);
+    }
 
-        root = buildRecursive(particles, particleBounds, 0, particles.size());
+    // Moves the particles into leaf order so that neighbors in the tree are neighbors in memory.
+    // The tree stays valid, but particle indices held anywhere else refer to other particles afterwards.
+    void reorderParticles(ParticleSystem& particles) {
+        if (primIndices.size() != particles.size()) {
+            return;
+        }
+        // Gather every column into the spare system and swap, the buffers are reused next time
+        reorderScratch.gather(particles, primIndices);
+        particles.swap(reorderScratch);
+        for (size_t slot = 0; slot < primIndices.size(); ++slot) {
+            primIndices[slot] = static_cast<uint32_t>(slot);
+        }
+        if (root != BVHNode::NullIndex) {
+            assignParticleLeaves(root);
+        }
     }
 
-    std::vector<int> query(const AABB& queryBounds) {
+    // Recomputes the bounds bottom-up from the current particle positions,
+    // keeping the topology. Returns false if the tree has to be rebuilt instead; the wide and
+    // quantized nodes are then dropped and queries walk the refitted binary nodes until the rebuild.
+    // Without checkQuality the tree is kept however much its area grew, for callers that replace
+    // it soon anyway; it then only fails if the particle count changed.
+    bool refit(const ParticleSystem& particles, bool checkQuality = true) {
+        if (root == BVHNode::NullIndex || primIndices.size() != particles.size()) {
+            return false;
+        }
+
+        float area = refitRecursive(root, particles);
+        if (checkQuality && area > rebuildThreshold * builtArea) {
+            activeLayout = NodeLayout::Binary;
+            return false;
+        }
+        updateLayout(false);
+        return true;
+    }
+
+    std::vector<int> query(const AABB& queryBounds) const {
         std::vector<int> result;
-        queryRecursive(root, queryBounds, result);
+        query(queryBounds, result);
         return result;
     }
 
-    void updateParticles(std::vector<Particle>& particles, float deltaTime) {
-        for (auto& particle : particles) {
-            particle.update(deltaTime);
+    // Appends the indices of the overlapping particles to a caller-owned buffer
+    void query(const AABB& queryBounds, std::vector<int>& result) const {
+        query(queryBounds, [&result](int particleIndex) {
+            result.push_back(particleIndex);
+        });
+    }
 
-            // new code
-            bool hitX = false, hitY = false;
-            glm::vec2 pos = particle.getPosition();
-            glm::vec2 velocity = particle.getVelocity();
-            const float minX = -0.94f, maxX = 0.94f;
-            const float minY = -0.94f, maxY = 0.94f;
+    // Calls visitor(particleIndex) for every particle whose box overlaps queryBounds.
+    // The walk is iterative over a fixed-size stack and does not allocate.
+    template <typename Visitor>
+    void query(const AABB& queryBounds, Visitor&& visitor) const {
+        if (root == BVHNode::NullIndex) {
+            return;
+        }
+        if (activeLayout == NodeLayout::Wide4) {
+            queryWide(queryBounds, visitor);
+            return;
+        }
+        if (activeLayout == NodeLayout::Quantized4) {
+            queryQuantized(queryBounds, visitor);
+            return;
+        }
+        queryBinary(root, queryBounds, visitor);
+    }
+
+    // Same result as query, but starts at the leaf of particleIndex and climbs towards the root,
+    // walking the sibling subtree at every level. Boxes of sibling subtrees may overlap anywhere,
+    // so the climb cannot stop once the query box is contained; what it saves is testing the
+    // ancestors, which a query around the particle itself overlaps anyway.
+    template <typename Visitor>
+    void queryNear(int particleIndex, const AABB& queryBounds, Visitor&& visitor) const {
+        if (root == BVHNode::NullIndex) {
+            return;
+        }
+        if (particleIndex < 0 || static_cast<size_t>(particleIndex) >= particleLeaves.size()) {
+            queryBinary(root, queryBounds, visitor);
+            return;
+        }
+
+        uint32_t nodeIndex = particleLeaves[particleIndex];
+        const BVHNode& leaf = nodes[nodeIndex];
+        if (leaf.bounds.overlaps(queryBounds)) {
+            forEachLeafOverlap(leaf, queryBounds, visitor);
+        }
+        while (nodeIndex != root) {
+            const BVHNode& parent = nodes[nodes[nodeIndex].parent];
+            uint32_t sibling = parent.left == nodeIndex ? parent.right : parent.left;
+            queryBinary(sibling, queryBounds, visitor);
+            nodeIndex = nodes[nodeIndex].parent;
+        }
+    }
 
-        // Check collisions with vertical boundaries
-            if (pos.x < minX) {
-                pos.x = minX;
-                velocity.x = -velocity.x * 0.9f; // Reflect and dampen
-                hitX = true;
-            } else if (pos.x > maxX) {
-                pos.x = maxX;
-                velocity.x = -velocity.x * 0.9f;
-                hitX = true;
+    struct Neighbor {
+        int particleIndex;
+        float distanceSquared;
+    };
+
+    struct RayHit {
+        int particleIndex;
+        float t; // Distance along the ray in units of the direction's length
+    };
+
+    // The distance queries below measure to particle centers, taken as the centers of their
+    // boxes, and walk the binary nodes whatever the layout.
+
+    // Index of the particle closest to point, or -1 if the tree is empty
+    int nearest(const glm::vec2& point) const {
+        int best = -1;
+        float bestDistance = std::numeric_limits<float>::infinity();
+        if (root == BVHNode::NullIndex) {
+            return best;
+        }
+
+        auto visitLeaf = [&](const BVHNode& leaf) {
+            for (uint32_t slot = leaf.first; slot < leaf.first + leaf.count; ++slot) {
+                float distance = slotDistanceSquared(slot, point);
+                if (distance < bestDistance) {
+                    bestDistance = distance;
+                    best = static_cast<int>(primIndices[slot]);
+                }
             }
+        };
+        closestFirst(root, point, bestDistance, visitLeaf);
+        return best;
+    }
+
+    std::vector<Neighbor> kNearest(const glm::vec2& point, size_t k) const {
+        std::vector<Neighbor> result;
+        kNearest(point, k, result);
+        return result;
+    }
 
-            // Check collisions with horizontal boundaries
-            if (pos.y < minY) {
-                pos.y = minY;
-                velocity.y = -velocity.y * 0.9f;
-                hitY = true;
-            } else if (pos.y > maxY) {
-                pos.y = maxY;
-                velocity.y = -velocity.y * 0.9f;
-                hitY = true;
+    // Fills result with the k particles closest to point, nearest first. result doubles as the
+    // bounded max-heap during the walk, so a reused buffer does not allocate.
+    void kNearest(const glm::vec2& point, size_t k, std::vector<Neighbor>& result) const {
+        result.clear();
+        if (root == BVHNode::NullIndex || k == 0) {
+            return;
+        }
+
+        auto closer = [](const Neighbor& a, const Neighbor& b) {
+            return a.distanceSquared < b.distanceSquared;
+        };
+        // Until k candidates are found nothing can be pruned, afterwards only nodes closer than the worst one
+        float radiusSquared = std::numeric_limits<float>::infinity();
+        auto visitLeaf = [&](const BVHNode& leaf) {
+            for (uint32_t slot = leaf.first; slot < leaf.first + leaf.count; ++slot) {
+                float distance = slotDistanceSquared(slot, point);
+                Neighbor candidate = { static_cast<int>(primIndices[slot]), distance };
+                if (result.size() < k) {
+                    result.push_back(candidate);
+                    std::push_heap(result.begin(), result.end(), closer);
+                } else if (distance < result.front().distanceSquared) {
+                    std::pop_heap(result.begin(), result.end(), closer);
+                    result.back() = candidate;
+                    std::push_heap(result.begin(), result.end(), closer);
+                } else {
+                    continue;
+                }
+                if (result.size() == k) {
+                    radiusSquared = result.front().distanceSquared;
+                }
             }
+        };
+        closestFirst(root, point, radiusSquared, visitLeaf);
+        std::sort_heap(result.begin(), result.end(), closer);
+    }
 
-            // Handle corner cases: dampen velocity slightly if both axes collide
-            if (hitX && hitY) {
-                velocity *= 0.9f; // Extra damping to resolve sticking
+    // Finds the first particle box hit by origin + t * direction for t in [0, tMax]. Children are
+    // entered front to back, so everything behind the closest hit found so far is skipped.
+    bool raycast(const glm::vec2& origin, const glm::vec2& direction, float tMax, RayHit& hit) const {
+        hit.particleIndex = -1;
+        hit.t = tMax;
+        float tEntry;
+        if (root == BVHNode::NullIndex) {
+            return false;
+        }
+        glm::vec2 inverseDirection = 1.0f / direction;
+        if (!nodes[root].bounds.intersectRay(origin, inverseDirection, tMax, tEntry)) {
+            return false;
+        }
+        frontToBack(root, tEntry, origin, inverseDirection, hit);
+        return hit.particleIndex >= 0;
+    }
+
+    // Appends the indices of the particles within radius of center to a caller-owned buffer
+    void queryRadius(const glm::vec2& center, float radius, std::vector<int>& result) const {
+        queryRadius(center, radius, [&result](int particleIndex) {
+            result.push_back(particleIndex);
+        });
+    }
+
+    // Calls visitor(particleIndex) for every particle whose center is closer than radius to center.
+    // Nodes are pruned by their squared distance to center and particles are tested with squared
+    // distances, so the visitor only sees true candidates and no square root is taken.
+    template <typename Visitor>
+    void queryRadius(const glm::vec2& center, float radius, Visitor&& visitor) const {
+        if (root == BVHNode::NullIndex) {
+            return;
+        }
+        queryRadiusFrom(root, center, radius * radius, visitor);
+    }
+
+    // Answers many box queries in one pass, calling visitor(queryIndex, particleIndex) for every
+    // overlap. Queries descend in packets of 64 that carry a bit mask of the queries still inside
+    // the current node, so the upper levels are loaded once per packet rather than once per query.
+    // Packets prune best when neighboring queries are close in space, e.g. in Morton order.
+    template <typename Visitor>
+    void queryBatch(const AABB* queries, size_t count, Visitor&& visitor) const {
+        if (root == BVHNode::NullIndex) {
+            return;
+        }
+        for (size_t base = 0; base < count; base += 64) {
+            size_t packetSize = std::min<size_t>(64, count - base);
+            uint64_t active = packetSize == 64 ? ~uint64_t(0) : (uint64_t(1) << packetSize) - 1;
+            queryPacket(root, queries + base, base, active, visitor);
+        }
+    }
+
+    template <typename Visitor>
+    void queryBatch(const std::vector<AABB>& queries, Visitor&& visitor) const {
+        queryBatch(queries.data(), queries.size(), visitor);
+    }
+
+    // Collects every pair of particles whose boxes overlap as (i, j) with i < j, each pair
+    // exactly once, by descending the tree against itself. pairs is cleared and refilled.
+    void findOverlappingPairs(std::vector<std::pair<int, int>>& pairs) const {
+        pairs.clear();
+        if (root == BVHNode::NullIndex) {
+            return;
+        }
+
+        // Node pairs still to visit, taken from the frame arena
+        FrameArena& arena = threadFrameArena();
+        ArenaScope scope(arena);
+        FrameVector<std::pair<uint32_t, uint32_t>> pairStack{ ArenaAllocator<std::pair<uint32_t, uint32_t>>(arena) };
+        pairStack.emplace_back(root, root);
+        while (!pairStack.empty()) {
+            uint32_t a = pairStack.back().first;
+            uint32_t b = pairStack.back().second;
+            pairStack.pop_back();
+            const BVHNode& nodeA = nodes[a];
+            const BVHNode& nodeB = nodes[b];
+
+            if (a == b) {
+                // A subtree against itself: both children against themselves and each other
+                if (nodeA.isLeaf()) {
+                    collectLeafPairs(nodeA, pairs);
+                } else {
+                    pairStack.emplace_back(nodeA.left, nodeA.right);
+                    pairStack.emplace_back(nodeA.right, nodeA.right);
+                    pairStack.emplace_back(nodeA.left, nodeA.left);
+                }
+                continue;
+            }
+
+            if (!nodeA.bounds.overlaps(nodeB.bounds)) {
+                continue;
             }
 
-            particle.position = pos;
-            particle.velocity = velocity;
+            if (nodeA.isLeaf() && nodeB.isLeaf()) {
+                collectLeafPairs(nodeA, nodeB, pairs);
+            } else if (nodeA.isLeaf() || (!nodeB.isLeaf() && nodeB.bounds.area() > nodeA.bounds.area())) {
+                // Descend into the larger node first to prune faster
+                pairStack.emplace_back(a, nodeB.right);
+                pairStack.emplace_back(a, nodeB.left);
+            } else {
+                pairStack.emplace_back(nodeA.right, b);
+                pairStack.emplace_back(nodeA.left, b);
+            }
+        }
+    }
+
+    void updateParticles(ParticleSystem& particles, float deltaTime) {
+        integrateParticles(particles, deltaTime);
+        // Particles move little per step, so refit and only rebuild once the tree degrades
+        if (!refitEnabled || !refit(particles)) {
+            build(particles);
         }
-        // end of new code
-        build(particles); // Rebuild BVH after updating particles
     }
 
 private:
-    BVHNode* buildRecursive(std::vector<Particle>& particles, std::vector<AABB>& particleBounds, size_t start, size_t end) {
-        BVHNode* node = new BVHNode();
+    void buildBinary(const ParticleSystem& particles) {
+        resizeSlots(particles.size());
+        if (strategy == BuildStrategy::LBVH) {
+            buildLinear(particles);
+            return;
+        }
+
+        // clear() keeps the capacity, so rebuilding every frame does not reallocate
+        particleBounds.clear();
+        for (size_t i = 0; i < particles.size(); ++i) {
+            particleBounds.push_back(particleAABB(particles.position(i)));
+        }
+
+        nodes.clear();
+        root = BVHNode::NullIndex;
+        if (particles.empty()) {
+            return;
+        }
+
+        // The builders partition primIndices in place, starting from the identity
+        for (size_t i = 0; i < particles.size(); ++i) {
+            primIndices[i] = static_cast<uint32_t>(i);
+        }
+
+        // A binary tree never needs more than 2N-1 nodes
+        nodes.reserve(2 * particles.size() - 1);
+        if (strategy == BuildStrategy::BinnedSAH) {
+            root = buildBinnedSAH(particles, 0, particles.size());
+        } else {
+            root = buildRecursive(particles, particleBounds, 0, particles.size());
+        }
+        builtArea = internalArea(root);
+    }
+
+    std::vector<AABB> particleBounds; // Scratch for build, kept to avoid reallocation
+    ParticleSystem reorderScratch; // Gather buffer for reorderParticles
+    float builtArea; // Summed internal node area after the last build
+    NodeLayout activeLayout; // Layout the wide and quantized nodes are up to date for, Binary if none
+
+    // LBVH visit counters, the rest of its scratch comes from the frame arena
+    std::unique_ptr<std::atomic<uint32_t>[]> buildFlags;
+    size_t buildFlagCapacity;
+
+    // Binned SAH scratch, one entry per bin
+    struct SAHBin {
+        AABB bounds;
+        size_t count;
+    };
+    std::vector<SAHBin> sahBins;
+    std::vector<float> sahRightCost;
+
+    // Binary node feeding every lane of the wide nodes, NullIndex for empty lanes
+    std::vector<std::array<uint32_t, 4>> wideLaneSources;
+
+    AABB slotBounds(uint32_t slot) const {
+        return AABB(leafMinX[slot], leafMinY[slot], leafMaxX[slot], leafMaxY[slot]);
+    }
+
+    static void addPair(std::vector<std::pair<int, int>>& pairs, int i, int j) {
+        pairs.emplace_back(std::min(i, j), std::max(i, j));
+    }
+
+    // Pairs of overlapping particles inside a single leaf
+    void collectLeafPairs(const BVHNode& leaf, std::vector<std::pair<int, int>>& pairs) const {
+        for (uint32_t s = leaf.first; s < leaf.first + leaf.count; ++s) {
+            AABB box = slotBounds(s);
+            for (uint32_t t = s + 1; t < leaf.first + leaf.count; ++t) {
+                if (box.overlaps(slotBounds(t))) {
+                    addPair(pairs, static_cast<int>(primIndices[s]), static_cast<int>(primIndices[t]));
+                }
+            }
+        }
+    }
+
+    // Pairs of overlapping particles across two different leaves
+    void collectLeafPairs(const BVHNode& leafA, const BVHNode& leafB, std::vector<std::pair<int, int>>& pairs) const {
+        for (uint32_t s = leafA.first; s < leafA.first + leafA.count; ++s) {
+            int i = static_cast<int>(primIndices[s]);
+            forEachLeafOverlap(leafB, slotBounds(s), [&pairs, i](int j) {
+                addPair(pairs, i, j);
+            });
+        }
+    }
+
+    void resizeSlots(size_t count) {
+        primIndices.resize(count);
+        leafMinX.resize(count);
+        leafMinY.resize(count);
+        leafMaxX.resize(count);
+        leafMaxY.resize(count);
+    }
+
+    // Refreshes the slot boxes of a leaf and its bounds from the particle positions
+    void updateLeaf(BVHNode& leaf, const ParticleSystem& particles) {
+        for (uint32_t slot = leaf.first; slot < leaf.first + leaf.count; ++slot) {
+            AABB box = particleAABB(particles.position(primIndices[slot]));
+            leafMinX[slot] = box.minX;
+            leafMinY[slot] = box.minY;
+            leafMaxX[slot] = box.maxX;
+            leafMaxY[slot] = box.maxY;
+            if (slot == leaf.first) {
+                leaf.bounds = box;
+            } else {
+                leaf.bounds.expand(box);
+            }
+        }
+    }
+
+    void makeLeaf(BVHNode& leaf, const ParticleSystem& particles, size_t start, size_t end) {
+        leaf.left = BVHNode::NullIndex;
+        leaf.right = BVHNode::NullIndex;
+        leaf.first = static_cast<uint32_t>(start);
+        leaf.count = static_cast<uint32_t>(end - start);
+        updateLeaf(leaf, particles);
+    }
+
+    size_t leafLimit() const {
+        return static_cast<size_t>(std::max(1, maxLeafSize));
+    }
+
+    // Calls fn(particleIndex) for every particle of the leaf whose box overlaps queryBounds.
+    // Same predicate as AABB::overlaps, evaluated 8 or 4 slots at a time when available.
+    template <typename Fn>
+    void forEachLeafOverlap(const BVHNode& leaf, const AABB& queryBounds, Fn&& fn) const {
+        uint32_t slot = leaf.first;
+        const uint32_t end = leaf.first + leaf.count;
+#if defined(__AVX__)
+        const __m256 queryMinX8 = _mm256_set1_ps(queryBounds.minX);
+        const __m256 queryMinY8 = _mm256_set1_ps(queryBounds.minY);
+        const __m256 queryMaxX8 = _mm256_set1_ps(queryBounds.maxX);
+        const __m256 queryMaxY8 = _mm256_set1_ps(queryBounds.maxY);
+        for (; slot + 8 <= end; slot += 8) {
+            __m256 separated = _mm256_or_ps(
+                _mm256_or_ps(_mm256_cmp_ps(_mm256_loadu_ps(&leafMinX[slot]), queryMaxX8, _CMP_GT_OQ),
+                             _mm256_cmp_ps(_mm256_loadu_ps(&leafMaxX[slot]), queryMinX8, _CMP_LT_OQ)),
+                _mm256_or_ps(_mm256_cmp_ps(_mm256_loadu_ps(&leafMinY[slot]), queryMaxY8, _CMP_GT_OQ),
+                             _mm256_cmp_ps(_mm256_loadu_ps(&leafMaxY[slot]), queryMinY8, _CMP_LT_OQ)));
+            unsigned hits = ~static_cast<unsigned>(_mm256_movemask_ps(separated)) & 0xFFu;
+            while (hits) {
+                fn(static_cast<int>(primIndices[slot + __builtin_ctz(hits)]));
+                hits &= hits - 1;
+            }
+        }
+#endif
+#if defined(__SSE2__)
+        const __m128 queryMinX = _mm_set1_ps(queryBounds.minX);
+        const __m128 queryMinY = _mm_set1_ps(queryBounds.minY);
+        const __m128 queryMaxX = _mm_set1_ps(queryBounds.maxX);
+        const __m128 queryMaxY = _mm_set1_ps(queryBounds.maxY);
+        for (; slot + 4 <= end; slot += 4) {
+            __m128 separated = _mm_or_ps(
+                _mm_or_ps(_mm_cmpgt_ps(_mm_loadu_ps(&leafMinX[slot]), queryMaxX),
+                          _mm_cmplt_ps(_mm_loadu_ps(&leafMaxX[slot]), queryMinX)),
+                _mm_or_ps(_mm_cmpgt_ps(_mm_loadu_ps(&leafMinY[slot]), queryMaxY),
+                          _mm_cmplt_ps(_mm_loadu_ps(&leafMaxY[slot]), queryMinY)));
+            unsigned hits = ~static_cast<unsigned>(_mm_movemask_ps(separated)) & 0xFu;
+            while (hits) {
+                fn(static_cast<int>(primIndices[slot + __builtin_ctz(hits)]));
+                hits &= hits - 1;
+            }
+        }
+#endif
+        for (; slot < end; ++slot) {
+            if (!(leafMinX[slot] > queryBounds.maxX || leafMaxX[slot] < queryBounds.minX ||
+                  leafMinY[slot] > queryBounds.maxY || leafMaxY[slot] < queryBounds.minY)) {
+                fn(static_cast<int>(primIndices[slot]));
+            }
+        }
+    }
+
+    // Returns the summed internal node area of the refitted subtree
+    float refitRecursive(uint32_t nodeIndex, const ParticleSystem& particles) {
+        BVHNode& node = nodes[nodeIndex];
+        if (node.isLeaf()) {
+            updateLeaf(node, particles);
+            return 0.0f;
+        }
+
+        float area = refitRecursive(node.left, particles) + refitRecursive(node.right, particles);
+        node.bounds = nodes[node.left].bounds;
+        node.bounds.expand(nodes[node.right].bounds);
+        return area + node.bounds.area();
+    }
+
+    // Walks from the root since the LBVH pool can contain unreferenced slots
+    void assignParticleLeaves(uint32_t nodeIndex) {
+        const BVHNode& node = nodes[nodeIndex];
+        if (!node.isLeaf()) {
+            assignParticleLeaves(node.left);
+            assignParticleLeaves(node.right);
+            return;
+        }
+        for (uint32_t slot = node.first; slot < node.first + node.count; ++slot) {
+            particleLeaves[primIndices[slot]] = nodeIndex;
+        }
+    }
+
+    float internalArea(uint32_t nodeIndex) const {
+        const BVHNode& node = nodes[nodeIndex];
+        if (node.isLeaf()) {
+            return 0.0f;
+        }
+        return node.bounds.area() + internalArea(node.left) + internalArea(node.right);
+    }
+
+    uint32_t buildRecursive(const ParticleSystem& particles, const std::vector<AABB>& particleBounds, size_t start, size_t end) {
+        uint32_t nodeIndex = static_cast<uint32_t>(nodes.size());
+        nodes.emplace_back();
 
         // Compute the bounding box of the current set of particles
-        for (size_t i = start; i < end; ++i) {
-            node->bounds.expand(particleBounds[i]);
+        AABB bounds = particleBounds[primIndices[start]];
+        for (size_t i = start + 1; i < end; ++i) {
+            bounds.expand(particleBounds[primIndices[i]]);
         }
+        nodes[nodeIndex].bounds = bounds;
 
         size_t count = end - start;
 
-        if (count == 1) {
+        if (count <= leafLimit()) {
             // Leaf node
-            node->particleIndex = start;
-            return node;
+            makeLeaf(nodes[nodeIndex], particles, start, end);
+            return nodeIndex;
         }
 
         // Split along the largest axis
-        float extentX = node->bounds.maxX - node->bounds.minX;
-        float extentY = node->bounds.maxY - node->bounds.minY;
+        float extentX = bounds.maxX - bounds.minX;
+        float extentY = bounds.maxY - bounds.minY;
         int axis = (extentX > extentY) ? 0 : 1;
 
-        std::sort(particles.begin() + start, particles.begin() + end,
-                  [axis](const Particle& a, const Particle& b) {
-                      if (axis == 0) {
-                          return a.getPosition().x < b.getPosition().x;
-                      } else {
-                          return a.getPosition().y < b.getPosition().y;
-                      }
-                  });
+        // Only the median has to be in place, so an O(N) selection replaces the full sort
+        size_t mid = start + count / 2;
+        std::nth_element(primIndices.begin() + start, primIndices.begin() + mid, primIndices.begin() + end,
+                         [&particles, axis](uint32_t a, uint32_t b) {
+                             return particles.position(a)[axis] < particles.position(b)[axis];
+                         });
+
+        // Children are appended after the parent, so fetch the indices before touching nodes again
+        uint32_t left = buildRecursive(particles, particleBounds, start, mid);
+        uint32_t right = buildRecursive(particles, particleBounds, mid, end);
+        nodes[nodeIndex].left = left;
+        nodes[nodeIndex].right = right;
+        nodes[left].parent = nodeIndex;
+        nodes[right].parent = nodeIndex;
+
+        return nodeIndex;
+    }
+
+    uint32_t buildBinnedSAH(const ParticleSystem& particles, size_t start, size_t end) {
+        uint32_t nodeIndex = static_cast<uint32_t>(nodes.size());
+        nodes.emplace_back();
+
+        AABB bounds = particleBounds[primIndices[start]];
+        glm::vec2 centroidMin = particles.position(primIndices[start]);
+        glm::vec2 centroidMax = centroidMin;
+        for (size_t i = start + 1; i < end; ++i) {
+            glm::vec2 position = particles.position(primIndices[i]);
+            bounds.expand(particleBounds[primIndices[i]]);
+            centroidMin = glm::min(centroidMin, position);
+            centroidMax = glm::max(centroidMax, position);
+        }
+        nodes[nodeIndex].bounds = bounds;
+
+        size_t count = end - start;
+        if (count == 1) {
+            makeLeaf(nodes[nodeIndex], particles, start, end);
+            return nodeIndex;
+        }
+
+        // Evaluate every bin boundary on both axes:
+        // cost = traversal + leafCost * (A_left * N_left + A_right * N_right) / A_node
+        const int binCount = std::max(2, sahBinCount);
+        sahBins.resize(binCount);
+        sahRightCost.resize(binCount);
+        float bestCost = std::numeric_limits<float>::max();
+        int bestAxis = -1;
+        int bestSplit = 0;
+
+        for (int axis = 0; axis < 2; ++axis) {
+            float axisMin = centroidMin[axis];
+            float axisExtent = centroidMax[axis] - axisMin;
+            if (axisExtent <= 0.0f) {
+                continue;
+            }
+            float binScale = binCount / axisExtent;
+
+            for (SAHBin& bin : sahBins) {
+                bin.count = 0;
+            }
+            for (size_t i = start; i < end; ++i) {
+                uint32_t index = primIndices[i];
+                int b = std::min(binCount - 1, static_cast<int>((particles.position(index)[axis] - axisMin) * binScale));
+                SAHBin& bin = sahBins[b];
+                if (bin.count++ == 0) {
+                    bin.bounds = particleBounds[index];
+                } else {
+                    bin.bounds.expand(particleBounds[index]);
+                }
+            }
+
+            // Sweep from the right to get the right-hand cost of every split
+            AABB rightBounds;
+            size_t rightCount = 0;
+            for (int b = binCount - 1; b > 0; --b) {
+                if (sahBins[b].count > 0) {
+                    if (rightCount == 0) {
+                        rightBounds = sahBins[b].bounds;
+                    } else {
+                        rightBounds.expand(sahBins[b].bounds);
+                    }
+                    rightCount += sahBins[b].count;
+                }
+                sahRightCost[b] = rightCount > 0 ? rightBounds.area() * rightCount : 0.0f;
+            }
+
+            // Sweep from the left, a split after bin b puts bins [0, b] on the left
+            AABB leftBounds;
+            size_t leftCount = 0;
+            for (int b = 0; b < binCount - 1; ++b) {
+                if (sahBins[b].count > 0) {
+                    if (leftCount == 0) {
+                        leftBounds = sahBins[b].bounds;
+                    } else {
+                        leftBounds.expand(sahBins[b].bounds);
+                    }
+                    leftCount += sahBins[b].count;
+                }
+                if (leftCount == 0 || leftCount == count) {
+                    continue;
+                }
+                float cost = sahTraversalCost +
+                             sahLeafCost * (leftBounds.area() * leftCount + sahRightCost[b + 1]) / bounds.area();
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = b;
+                }
+            }
+        }
+
+        // Keep the range as one leaf when it fits and testing it directly is cheaper than splitting
+        if (count <= leafLimit() && (bestAxis < 0 || sahLeafCost * count <= bestCost)) {
+            makeLeaf(nodes[nodeIndex], particles, start, end);
+            return nodeIndex;
+        }
 
         size_t mid = start + count / 2;
+        if (bestAxis >= 0) {
+            float axisMin = centroidMin[bestAxis];
+            float binScale = binCount / (centroidMax[bestAxis] - axisMin);
+            auto split = std::partition(primIndices.begin() + start, primIndices.begin() + end,
+                                        [&](uint32_t index) {
+                                            int b = std::min(binCount - 1, static_cast<int>((particles.position(index)[bestAxis] - axisMin) * binScale));
+                                            return b <= bestSplit;
+                                        });
+            mid = static_cast<size_t>(split - primIndices.begin());
+        }
+        // Otherwise every centroid coincides and any split is as good as the median
 
-        node->left = buildRecursive(particles, particleBounds, start, mid);
-        node->right = buildRecursive(particles, particleBounds, mid, end);
+        uint32_t left = buildBinnedSAH(particles, start, mid);
+        uint32_t right = buildBinnedSAH(particles, mid, end);
+        nodes[nodeIndex].left = left;
+        nodes[nodeIndex].right = right;
+        nodes[left].parent = nodeIndex;
+        nodes[right].parent = nodeIndex;
+
+        return nodeIndex;
+    }
+
+    // Spreads the low 15 bits of v so that there is a zero bit between each of them
+    static uint32_t expandBits(uint32_t v) {
+        v &= 0x00007FFF;
+        v = (v | (v << 8)) & 0x00FF00FF;
+        v = (v | (v << 4)) & 0x0F0F0F0F;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    }
 
-        return node;
+    // Length of the common prefix of the sorted keys at i and j, -1 if j is out of range.
+    // Equal Morton codes fall back to comparing the positions, which keeps keys unique.
+    static int commonPrefix(const uint32_t* keys, int i, int j, int count) {
+        if (j < 0 || j >= count) {
+            return -1;
+        }
+        uint32_t a = keys[i];
+        uint32_t b = keys[j];
+        if (a == b) {
+            return 32 + __builtin_clz(static_cast<uint32_t>(i) ^ static_cast<uint32_t>(j));
+        }
+        return __builtin_clz(a ^ b);
     }
 
-    void queryRecursive(BVHNode* node, const AABB& queryBounds, std::vector<int>& result) {
-        if (!node || !node->bounds.overlaps(queryBounds)) {
+    // Karras 2012: every internal node is emitted independently from the sorted keys.
+    // Internal nodes occupy [0, N-1), a leaf starting at sorted key i sits at N-1+i.
+    // Key ranges of at most maxLeafSize become leaves and the nodes below them are skipped.
+    void buildLinear(const ParticleSystem& particles) {
+        nodes.clear();
+        root = BVHNode::NullIndex;
+        if (particles.empty()) {
             return;
         }
 
-        if (node->isLeaf()) {
-            result.push_back(node->particleIndex);
+        const size_t count = particles.size();
+        const unsigned workers = workerCount(count, 4096);
+
+        // Quantize particle centers to a 2^15 x 2^15 grid over the scene bounds
+        glm::vec2 sceneMin = particles.position(0);
+        glm::vec2 sceneMax = sceneMin;
+        for (size_t i = 0; i < count; ++i) {
+            sceneMin = glm::min(sceneMin, particles.position(i));
+            sceneMax = glm::max(sceneMax, particles.position(i));
+        }
+        glm::vec2 extent = glm::max(sceneMax - sceneMin, glm::vec2(1e-6f));
+        glm::vec2 scale = glm::vec2(32767.0f) / extent;
+
+        // Morton codes and particle indices, double buffered for the radix sort
+        FrameArena& arena = threadFrameArena();
+        ArenaScope scope(arena);
+        FrameVector<uint32_t> mortonCodes(count, ArenaAllocator<uint32_t>(arena));
+        FrameVector<uint32_t> mortonScratch(count, ArenaAllocator<uint32_t>(arena));
+        FrameVector<uint32_t> sortedIndices(count, ArenaAllocator<uint32_t>(arena));
+        FrameVector<uint32_t> indexScratch(count, ArenaAllocator<uint32_t>(arena));
+        FrameVector<uint32_t> radixHistogram{ ArenaAllocator<uint32_t>(arena) };
+        parallelFor(count, workers, [&](size_t begin, size_t end, unsigned) {
+            for (size_t i = begin; i < end; ++i) {
+                glm::vec2 cell = (particles.position(i) - sceneMin) * scale;
+                uint32_t x = static_cast<uint32_t>(glm::clamp(cell.x, 0.0f, 32767.0f));
+                uint32_t y = static_cast<uint32_t>(glm::clamp(cell.y, 0.0f, 32767.0f));
+                mortonCodes[i] = (expandBits(x) << 1) | expandBits(y);
+                sortedIndices[i] = static_cast<uint32_t>(i);
+            }
+        });
+
+        radixSortPairs(mortonCodes, sortedIndices, mortonScratch, indexScratch, count, 30, workers, radixHistogram);
+        std::copy(sortedIndices.begin(), sortedIndices.end(), primIndices.begin());
+
+        if (count <= leafLimit()) {
+            nodes.resize(1);
+            makeLeaf(nodes[0], particles, 0, count);
+            nodes[0].parent = BVHNode::NullIndex;
+            root = 0;
+            builtArea = 0.0f;
+            return;
+        }
+
+        const size_t nodeCount = 2 * count - 1;
+        const uint32_t leafBase = static_cast<uint32_t>(count - 1);
+        const size_t maxLeaf = leafLimit();
+        nodes.resize(nodeCount);
+        nodes[0].parent = BVHNode::NullIndex;
+        FrameVector<uint8_t> leafStarts(count, 0, ArenaAllocator<uint8_t>(arena));
+        if (buildFlagCapacity < count) {
+            buildFlags.reset(new std::atomic<uint32_t>[count]);
+            buildFlagCapacity = count;
+        }
+
+        // Emit the hierarchy: each internal node finds its key range and split position
+        const int n = static_cast<int>(count);
+        const uint32_t* keys = mortonCodes.data();
+        parallelFor(count - 1, workers, [&](size_t begin, size_t end, unsigned) {
+            for (size_t k = begin; k < end; ++k) {
+                int i = static_cast<int>(k);
+                int direction = (commonPrefix(keys, i, i + 1, n) - commonPrefix(keys, i, i - 1, n)) >= 0 ? 1 : -1;
+
+                // Find the other end of the range by exponential then binary search
+                int minPrefix = commonPrefix(keys, i, i - direction, n);
+                int maxLength = 2;
+                while (commonPrefix(keys, i, i + maxLength * direction, n) > minPrefix) {
+                    maxLength *= 2;
+                }
+                int length = 0;
+                for (int step = maxLength / 2; step >= 1; step /= 2) {
+                    if (commonPrefix(keys, i, i + (length + step) * direction, n) > minPrefix) {
+                        length += step;
+                    }
+                }
+                int j = i + length * direction;
+                if (static_cast<size_t>(length) + 1 <= maxLeaf) {
+                    continue; // Covered by a leaf created by an ancestor
+                }
+
+                // Split where the common prefix with i changes
+                int nodePrefix = commonPrefix(keys, i, j, n);
+                int split = 0;
+                int step = length;
+                do {
+                    step = (step + 1) / 2;
+                    if (commonPrefix(keys, i, i + (split + step) * direction, n) > nodePrefix) {
+                        split += step;
+                    }
+                } while (step > 1);
+                int gamma = i + split * direction + std::min(direction, 0);
+
+                // Children covering few enough keys become leaves
+                int first = std::min(i, j);
+                int last = std::max(i, j);
+                BVHNode& node = nodes[i];
+                node.count = 0;
+                if (static_cast<size_t>(gamma - first) + 1 <= maxLeaf) {
+                    node.left = leafBase + first;
+                    nodes[node.left].first = static_cast<uint32_t>(first);
+                    nodes[node.left].count = static_cast<uint32_t>(gamma - first + 1);
+                    leafStarts[first] = 1;
+                } else {
+                    node.left = static_cast<uint32_t>(gamma);
+                }
+                if (static_cast<size_t>(last - gamma) <= maxLeaf) {
+                    node.right = leafBase + gamma + 1;
+                    nodes[node.right].first = static_cast<uint32_t>(gamma + 1);
+                    nodes[node.right].count = static_cast<uint32_t>(last - gamma);
+                    leafStarts[gamma + 1] = 1;
+                } else {
+                    node.right = static_cast<uint32_t>(gamma + 1);
+                }
+                nodes[node.left].parent = static_cast<uint32_t>(i);
+                nodes[node.right].parent = static_cast<uint32_t>(i);
+                buildFlags[i].store(0, std::memory_order_relaxed);
+            }
+        });
+
+        // Compute bounds bottom-up: the second child to arrive at a node finishes it
+        parallelFor(count, workers, [&](size_t begin, size_t end, unsigned) {
+            for (size_t k = begin; k < end; ++k) {
+                if (!leafStarts[k]) {
+                    continue;
+                }
+                uint32_t nodeIndex = leafBase + static_cast<uint32_t>(k);
+                BVHNode& leaf = nodes[nodeIndex];
+                leaf.left = BVHNode::NullIndex;
+                leaf.right = BVHNode::NullIndex;
+                updateLeaf(leaf, particles);
+
+                uint32_t parent = leaf.parent;
+                while (parent != BVHNode::NullIndex) {
+                    if (buildFlags[parent].fetch_add(1, std::memory_order_acq_rel) == 0) {
+                        break;
+                    }
+                    BVHNode& node = nodes[parent];
+                    node.bounds = nodes[node.left].bounds;
+                    node.bounds.expand(nodes[node.right].bounds);
+                    parent = node.parent;
+                }
+            }
+        });
+
+        root = 0;
+        builtArea = internalArea(root);
+    }
+
+    // Brings the wide and quantized nodes up to date for layout after a build or refit. A layout
+    // changed since the last build is collapsed or quantized here from the binary nodes.
+    void updateLayout(bool rebuilt) {
+        if (layout != NodeLayout::Binary) {
+            if (rebuilt || activeLayout == NodeLayout::Binary) {
+                collapseWide();
+            } else {
+                refitWide();
+            }
+        }
+        if (layout == NodeLayout::Quantized4) {
+            quantizeWide();
+        }
+        activeLayout = root == BVHNode::NullIndex ? NodeLayout::Binary : layout;
+    }
+
+    void collapseWide() {
+        wideNodes.clear();
+        wideLaneSources.clear();
+        wideRoot = BVHNode::NullIndex;
+        if (root != BVHNode::NullIndex) {
+            wideRoot = collapseRecursive(root);
+        }
+    }
+
+    // Emits the wide node for the binary subtree at nodeIndex. Its children are found by
+    // repeatedly opening the internal child with the largest area until there are four.
+    uint32_t collapseRecursive(uint32_t nodeIndex) {
+        uint32_t lanes[4];
+        int laneCount = 0;
+        if (nodes[nodeIndex].isLeaf()) {
+            lanes[laneCount++] = nodeIndex;
         } else {
-            queryRecursive(node->left, queryBounds, result);
-            queryRecursive(node->right, queryBounds, result);
+            lanes[laneCount++] = nodes[nodeIndex].left;
+            lanes[laneCount++] = nodes[nodeIndex].right;
+            while (laneCount < 4) {
+                int widest = -1;
+                float widestArea = -1.0f;
+                for (int lane = 0; lane < laneCount; ++lane) {
+                    const BVHNode& candidate = nodes[lanes[lane]];
+                    if (!candidate.isLeaf() && candidate.bounds.area() > widestArea) {
+                        widest = lane;
+                        widestArea = candidate.bounds.area();
+                    }
+                }
+                if (widest < 0) {
+                    break;
+                }
+                uint32_t opened = lanes[widest];
+                lanes[widest] = nodes[opened].left;
+                lanes[laneCount++] = nodes[opened].right;
+            }
+        }
+
+        uint32_t wideIndex = static_cast<uint32_t>(wideNodes.size());
+        wideNodes.emplace_back();
+        wideLaneSources.emplace_back();
+        for (int lane = 0; lane < 4; ++lane) {
+            uint32_t source = lane < laneCount ? lanes[lane] : BVHNode::NullIndex;
+            int32_t child = BVH4Node::EmptyLane;
+            if (source != BVHNode::NullIndex) {
+                // Recursing appends to wideNodes, so only index into it afterwards
+                child = nodes[source].isLeaf() ? ~static_cast<int32_t>(source)
+                                               : static_cast<int32_t>(collapseRecursive(source));
+            }
+            wideNodes[wideIndex].child[lane] = child;
+            wideLaneSources[wideIndex][lane] = source;
+            setWideLane(wideNodes[wideIndex], lane, source);
+        }
+        return wideIndex;
+    }
+
+    // Copies the bounds of a binary node into a lane, empty lanes get an inverted box
+    void setWideLane(BVH4Node& wide, int lane, uint32_t source) const {
+        if (source == BVHNode::NullIndex) {
+            wide.minX[lane] = wide.minY[lane] = std::numeric_limits<float>::max();
+            wide.maxX[lane] = wide.maxY[lane] = -std::numeric_limits<float>::max();
+            return;
+        }
+        const AABB& bounds = nodes[source].bounds;
+        wide.minX[lane] = bounds.minX;
+        wide.minY[lane] = bounds.minY;
+        wide.maxX[lane] = bounds.maxX;
+        wide.maxY[lane] = bounds.maxY;
+    }
+
+    // The wide topology follows the binary one, so a refit only copies the new bounds
+    void refitWide() {
+        for (size_t i = 0; i < wideNodes.size(); ++i) {
+            for (int lane = 0; lane < 4; ++lane) {
+                setWideLane(wideNodes[i], lane, wideLaneSources[i][lane]);
+            }
+        }
+    }
+
+    // Bit i is set if child i of the wide node overlaps queryBounds
+    static unsigned wideOverlapMask(const BVH4Node& node, const AABB& queryBounds) {
+#if defined(__SSE2__)
+        __m128 separated = _mm_or_ps(
+            _mm_or_ps(_mm_cmpgt_ps(_mm_load_ps(node.minX), _mm_set1_ps(queryBounds.maxX)),
+                      _mm_cmplt_ps(_mm_load_ps(node.maxX), _mm_set1_ps(queryBounds.minX))),
+            _mm_or_ps(_mm_cmpgt_ps(_mm_load_ps(node.minY), _mm_set1_ps(queryBounds.maxY)),
+                      _mm_cmplt_ps(_mm_load_ps(node.maxY), _mm_set1_ps(queryBounds.minY))));
+        return ~static_cast<unsigned>(_mm_movemask_ps(separated)) & 0xFu;
+#else
+        unsigned mask = 0;
+        for (int lane = 0; lane < 4; ++lane) {
+            if (!(node.minX[lane] > queryBounds.maxX || node.maxX[lane] < queryBounds.minX ||
+                  node.minY[lane] > queryBounds.maxY || node.maxY[lane] < queryBounds.minY)) {
+                mask |= 1u << lane;
+            }
+        }
+        return mask;
+#endif
+    }
+
+    // Same walk as query, over the wide nodes: one compare per node, then only the set
+    // bits of the hit mask are visited
+    template <typename Visitor>
+    void queryWide(const AABB& queryBounds, Visitor& visitor) const {
+        auto visit = [&](uint32_t wideIndex, uint32_t* children) {
+            const BVH4Node& node = wideNodes[wideIndex];
+            int childCount = 0;
+            for (unsigned hits = wideOverlapMask(node, queryBounds); hits; hits &= hits - 1) {
+                int32_t child = node.child[__builtin_ctz(hits)];
+                if (child == BVH4Node::EmptyLane) {
+                    continue; // Unbounded queries overlap the inverted box of an empty lane
+                }
+                if (child < 0) {
+                    forEachLeafOverlap(nodes[~child], queryBounds, visitor);
+                } else {
+                    children[childCount++] = static_cast<uint32_t>(child);
+                }
+            }
+            return childCount;
+        };
+        traverse(wideRoot, visit);
+    }
+
+    static float dequantize(float origin, float scale, uint16_t q) {
+        return origin + static_cast<float>(q) * scale;
+    }
+
+    // Picks origin and step for one axis. The step leaves headroom above the extent and
+    // stays several ulps wide, so the one-step outward margin absorbs any rounding.
+    static void quantizationFrame(float minValue, float maxValue, float& origin, float& scale) {
+        float magnitude = std::max(std::abs(minValue), std::abs(maxValue));
+        origin = minValue;
+        scale = std::max((maxValue - minValue) / 65000.0f, 8.0f * FLT_EPSILON * magnitude + FLT_MIN);
+    }
+
+    static uint16_t quantizeDown(float value, float origin, float scale) {
+        float steps = std::floor((value - origin) / scale) - 1.0f;
+        uint16_t q = static_cast<uint16_t>(std::min(65535.0f, std::max(0.0f, steps)));
+        while (q > 0 && dequantize(origin, scale, q) > value) {
+            --q;
+        }
+        return q;
+    }
+
+    static uint16_t quantizeUp(float value, float origin, float scale) {
+        float steps = std::ceil((value - origin) / scale) + 1.0f;
+        uint16_t q = static_cast<uint16_t>(std::min(65535.0f, std::max(0.0f, steps)));
+        while (q < 65535 && dequantize(origin, scale, q) < value) {
+            ++q;
+        }
+        return q;
+    }
+
+    void quantizeWide() {
+        quantizedNodes.resize(wideNodes.size());
+        for (size_t i = 0; i < wideNodes.size(); ++i) {
+            const BVH4Node& wide = wideNodes[i];
+            QBVH4Node& node = quantizedNodes[i];
+
+            // The node's own box is the union of its used lanes
+            float minX = std::numeric_limits<float>::max(), minY = minX;
+            float maxX = -std::numeric_limits<float>::max(), maxY = maxX;
+            for (int lane = 0; lane < 4; ++lane) {
+                if (wide.child[lane] != BVH4Node::EmptyLane) {
+                    minX = std::min(minX, wide.minX[lane]);
+                    minY = std::min(minY, wide.minY[lane]);
+                    maxX = std::max(maxX, wide.maxX[lane]);
+                    maxY = std::max(maxY, wide.maxY[lane]);
+                }
+            }
+            quantizationFrame(minX, maxX, node.originX, node.scaleX);
+            quantizationFrame(minY, maxY, node.originY, node.scaleY);
+
+            for (int lane = 0; lane < 4; ++lane) {
+                node.child[lane] = wide.child[lane];
+                if (wide.child[lane] == BVH4Node::EmptyLane) {
+                    // Inverted box, min above max on both axes. Boxes spanning the whole node
+                    // still overlap it, so the walks skip EmptyLane children explicitly.
+                    node.qMinX[lane] = node.qMinY[lane] = 65535;
+                    node.qMaxX[lane] = node.qMaxY[lane] = 0;
+                    continue;
+                }
+                node.qMinX[lane] = quantizeDown(wide.minX[lane], node.originX, node.scaleX);
+                node.qMinY[lane] = quantizeDown(wide.minY[lane], node.originY, node.scaleY);
+                node.qMaxX[lane] = quantizeUp(wide.maxX[lane], node.originX, node.scaleX);
+                node.qMaxY[lane] = quantizeUp(wide.maxY[lane], node.originY, node.scaleY);
+            }
+        }
+    }
+
+    // Decodes the four child boxes and tests them against queryBounds in one go
+    static unsigned quantizedOverlapMask(const QBVH4Node& node, const AABB& queryBounds) {
+#if defined(__SSE2__)
+        const __m128i zero = _mm_setzero_si128();
+        auto decode = [&zero](const uint16_t* q, float origin, float scale) {
+            __m128i wide = _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(q)), zero);
+            return _mm_add_ps(_mm_set1_ps(origin), _mm_mul_ps(_mm_cvtepi32_ps(wide), _mm_set1_ps(scale)));
+        };
+        __m128 separated = _mm_or_ps(
+            _mm_or_ps(_mm_cmpgt_ps(decode(node.qMinX, node.originX, node.scaleX), _mm_set1_ps(queryBounds.maxX)),
+                      _mm_cmplt_ps(decode(node.qMaxX, node.originX, node.scaleX), _mm_set1_ps(queryBounds.minX))),
+            _mm_or_ps(_mm_cmpgt_ps(decode(node.qMinY, node.originY, node.scaleY), _mm_set1_ps(queryBounds.maxY)),
+                      _mm_cmplt_ps(decode(node.qMaxY, node.originY, node.scaleY), _mm_set1_ps(queryBounds.minY))));
+        return ~static_cast<unsigned>(_mm_movemask_ps(separated)) & 0xFu;
+#else
+        unsigned mask = 0;
+        for (int lane = 0; lane < 4; ++lane) {
+            if (!(dequantize(node.originX, node.scaleX, node.qMinX[lane]) > queryBounds.maxX ||
+                  dequantize(node.originX, node.scaleX, node.qMaxX[lane]) < queryBounds.minX ||
+                  dequantize(node.originY, node.scaleY, node.qMinY[lane]) > queryBounds.maxY ||
+                  dequantize(node.originY, node.scaleY, node.qMaxY[lane]) < queryBounds.minY)) {
+                mask |= 1u << lane;
+            }
+        }
+        return mask;
+#endif
+    }
+
+    // Same walk as queryWide over the compressed nodes. Leaves are still tested exactly.
+    template <typename Visitor>
+    void queryQuantized(const AABB& queryBounds, Visitor& visitor) const {
+        auto visit = [&](uint32_t nodeIndex, uint32_t* children) {
+            const QBVH4Node& node = quantizedNodes[nodeIndex];
+            int childCount = 0;
+            for (unsigned hits = quantizedOverlapMask(node, queryBounds); hits; hits &= hits - 1) {
+                int32_t child = node.child[__builtin_ctz(hits)];
+                if (child == BVH4Node::EmptyLane) {
+                    continue; // Dequantized empty lanes still overlap boxes covering the whole node
+                }
+                if (child < 0) {
+                    forEachLeafOverlap(nodes[~child], queryBounds, visitor);
+                } else {
+                    children[childCount++] = static_cast<uint32_t>(child);
+                }
+            }
+            return childCount;
+        };
+        traverse(wideRoot, visit);
+    }
+
+    // Depth-first walk shared by the queries. visit(entry, children) handles one entry and
+    // returns how many of its children, at most four, to walk next, stored in children in the
+    // reverse of the order they are to be visited. Only degenerate trees get deeper than the
+    // fixed stack; those continue recursively on a fresh one.
+    template <typename Entry, typename Visit>
+    void traverse(const Entry& start, Visit& visit) const {
+        Entry stack[QueryStackSize];
+        int stackSize = 0;
+        stack[stackSize++] = start;
+
+        while (stackSize > 0) {
+            Entry entry = stack[--stackSize];
+            Entry children[4];
+            int childCount = visit(entry, children);
+            if (stackSize + childCount <= QueryStackSize) {
+                for (int c = 0; c < childCount; ++c) {
+                    stack[stackSize++] = children[c];
+                }
+            } else {
+                for (int c = childCount; c-- > 0;) {
+                    traverse(children[c], visit);
+                }
+            }
         }
     }
 
-    void deleteTree(BVHNode* node) {
-        if (!node) return;
-        deleteTree(node->left);
-        deleteTree(node->right);
-        delete node;
+    template <typename Visitor>
+    void queryRadiusFrom(uint32_t start, const glm::vec2& center, float radiusSquared, Visitor& visitor) const {
+        auto visit = [&](uint32_t nodeIndex, uint32_t* children) {
+            const BVHNode& node = nodes[nodeIndex];
+            // A node touching the circle only from outside cannot hold a center strictly inside it
+            if (node.bounds.distanceSquared(center) >= radiusSquared) {
+                return 0;
+            }
+            if (!node.isLeaf()) {
+                children[0] = node.right;
+                children[1] = node.left;
+                return 2;
+            }
+            for (uint32_t slot = node.first; slot < node.first + node.count; ++slot) {
+                if (slotDistanceSquared(slot, center) < radiusSquared) {
+                    visitor(static_cast<int>(primIndices[slot]));
+                }
+            }
+            return 0;
+        };
+        traverse(start, visit);
+    }
+
+    struct PacketEntry {
+        uint32_t node;
+        uint64_t mask; // Queries of the packet that overlap the parent
+    };
+
+    // Walks the binary nodes for one packet, whatever the layout
+    template <typename Visitor>
+    void queryPacket(uint32_t start, const AABB* packet, size_t base, uint64_t active, Visitor& visitor) const {
+        auto visit = [&](const PacketEntry& entry, PacketEntry* children) {
+            const BVHNode& node = nodes[entry.node];
+            uint64_t mask = 0;
+            for (uint64_t bits = entry.mask; bits; bits &= bits - 1) {
+                int q = __builtin_ctzll(bits);
+                if (node.bounds.overlaps(packet[q])) {
+                    mask |= uint64_t(1) << q;
+                }
+            }
+            if (mask == 0) {
+                return 0;
+            }
+            if (!node.isLeaf()) {
+                children[0] = { node.right, mask };
+                children[1] = { node.left, mask };
+                return 2;
+            }
+            for (; mask; mask &= mask - 1) {
+                size_t q = static_cast<size_t>(__builtin_ctzll(mask));
+                size_t queryIndex = base + q;
+                forEachLeafOverlap(node, packet[q], [&visitor, queryIndex](int particleIndex) {
+                    visitor(queryIndex, particleIndex);
+                });
+            }
+            return 0;
+        };
+        traverse(PacketEntry{ start, active }, visit);
+    }
+
+    // Stack entry of the ordered walks, distance is a squared distance or a ray entry distance
+    struct NodeDistance {
+        uint32_t node;
+        float distance;
+    };
+
+    float slotDistanceSquared(uint32_t slot, const glm::vec2& point) const {
+        glm::vec2 delta((leafMinX[slot] + leafMaxX[slot]) * 0.5f - point.x,
+                        (leafMinY[slot] + leafMaxY[slot]) * 0.5f - point.y);
+        return glm::dot(delta, delta);
+    }
+
+    // Depth-first walk that enters the closer child first and skips every node farther than
+    // radiusSquared, which visitLeaf shrinks as it finds closer particles
+    template <typename LeafFn>
+    void closestFirst(uint32_t start, const glm::vec2& point, float& radiusSquared, LeafFn& visitLeaf) const {
+        auto visit = [&](const NodeDistance& entry, NodeDistance* children) {
+            if (entry.distance > radiusSquared) {
+                return 0;
+            }
+            const BVHNode& node = nodes[entry.node];
+            if (node.isLeaf()) {
+                visitLeaf(node);
+                return 0;
+            }
+
+            NodeDistance nearChild = { node.left, nodes[node.left].bounds.distanceSquared(point) };
+            NodeDistance farChild = { node.right, nodes[node.right].bounds.distanceSquared(point) };
+            if (farChild.distance < nearChild.distance) {
+                std::swap(nearChild, farChild);
+            }
+            int childCount = 0;
+            if (farChild.distance <= radiusSquared) {
+                children[childCount++] = farChild;
+            }
+            children[childCount++] = nearChild;
+            return childCount;
+        };
+        traverse(NodeDistance{ start, nodes[start].bounds.distanceSquared(point) }, visit);
+    }
+
+    void frontToBack(uint32_t start, float startEntry, const glm::vec2& origin, const glm::vec2& inverseDirection,
+                     RayHit& hit) const {
+        auto visit = [&](const NodeDistance& entry, NodeDistance* children) {
+            if (entry.distance > hit.t) {
+                return 0;
+            }
+            const BVHNode& node = nodes[entry.node];
+            if (node.isLeaf()) {
+                for (uint32_t slot = node.first; slot < node.first + node.count; ++slot) {
+                    float t;
+                    if (slotBounds(slot).intersectRay(origin, inverseDirection, hit.t, t) &&
+                        (hit.particleIndex < 0 || t < hit.t)) {
+                        hit.particleIndex = static_cast<int>(primIndices[slot]);
+                        hit.t = t;
+                    }
+                }
+                return 0;
+            }
+
+            NodeDistance sides[2] = { { node.left, 0.0f }, { node.right, 0.0f } };
+            bool hits[2];
+            for (int c = 0; c < 2; ++c) {
+                hits[c] = nodes[sides[c].node].bounds.intersectRay(origin, inverseDirection, hit.t, sides[c].distance);
+            }
+            int nearSide = (hits[0] && hits[1]) ? (sides[1].distance < sides[0].distance ? 1 : 0) : (hits[0] ? 0 : 1);
+            int farSide = 1 - nearSide;
+            int childCount = 0;
+            if (hits[farSide]) {
+                children[childCount++] = sides[farSide];
+            }
+            if (hits[nearSide]) {
+                children[childCount++] = sides[nearSide];
+            }
+            return childCount;
+        };
+        traverse(NodeDistance{ start, startEntry }, visit);
+    }
+
+    // Root-down walk of the binary nodes below start
+    template <typename Visitor>
+    void queryBinary(uint32_t start, const AABB& queryBounds, Visitor& visitor) const {
+        auto visit = [&](uint32_t nodeIndex, uint32_t* children) {
+            const BVHNode& node = nodes[nodeIndex];
+            if (!node.bounds.overlaps(queryBounds)) {
+                return 0;
+            }
+            if (!node.isLeaf()) {
+                children[0] = node.right;
+                children[1] = node.left;
+                return 2;
+            }
+            forEachLeafOverlap(node, queryBounds, visitor);
+            return 0;
+        };
+        traverse(start, visit);
     }
 };
 
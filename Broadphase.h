@@ -0,0 +1,99 @@
+#ifndef BROADPHASE_H
+#define BROADPHASE_H
+
+#include <memory>
+#include <utility>
+#include <vector>
+#include "ParticleSystem.h"
+#include "BVH.h"
+#include "UniformGrid.h"
+#include "SweepAndPrune.h"
+#include "DynamicTree.h"
+#include "VerletList.h"
+#include "HierarchicalGrid.h"
+#include "AsyncBVH.h"
+
+// Runtime choice between the broadphases. Only the selected one is constructed, so the others
+// cost neither memory nor, for AsyncBVH, a worker thread.
+
+enum class BroadphaseType {
+    Tree, // BVH over the particle boxes
+    Grid, // Uniform grid with cell size equal to the particle diameter
+    Sweep, // Incremental sweep-and-prune over the particle boxes
+    Dynamic, // Dynamic AABB tree with fattened, incrementally reinserted leaves
+    Verlet, // Neighbor lists with a skin distance, rebuilt from a grid only when needed
+    Hierarchical, // Grid levels per particle size, for particles of different radii
+    AsyncTree // BVH rebuilt on a worker thread one step ahead, overlapping the narrowphase
+};
+
+class Broadphase {
+public:
+    virtual ~Broadphase() {}
+
+    // Full build from the initial particles
+    virtual void build(const ParticleSystem& particles) = 0;
+
+    // Integrates the particles and brings the broadphase up to date with them
+    virtual void updateParticles(ParticleSystem& particles, float deltaTime) = 0;
+
+    // Refills pairs with every candidate pair (i, j), i < j, exactly once
+    virtual void findOverlappingPairs(std::vector<std::pair<int, int>>& pairs) = 0;
+};
+
+// Initial build of every broadphase, for those whose entry point is not build()
+template <typename T>
+void buildBroadphase(T& broadphase, const ParticleSystem& particles) {
+    broadphase.build(particles);
+}
+
+inline void buildBroadphase(SweepAndPrune& sweep, const ParticleSystem& particles) {
+    sweep.update(particles);
+}
+
+inline void buildBroadphase(DynamicTree& tree, const ParticleSystem& particles) {
+    tree.sync(particles, 0.0f);
+}
+
+// Broadphase implemented by T, which is constructed in place from the given arguments
+template <typename T>
+class BroadphaseAdapter : public Broadphase {
+public:
+    T impl;
+
+    template <typename... Args>
+    explicit BroadphaseAdapter(Args&&... args) : impl(std::forward<Args>(args)...) {}
+
+    void build(const ParticleSystem& particles) override {
+        buildBroadphase(impl, particles);
+    }
+
+    void updateParticles(ParticleSystem& particles, float deltaTime) override {
+        impl.updateParticles(particles, deltaTime);
+    }
+
+    void findOverlappingPairs(std::vector<std::pair<int, int>>& pairs) override {
+        impl.findOverlappingPairs(pairs);
+    }
+};
+
+// Creates the broadphase of the given type for particles of the given radius
+inline std::unique_ptr<Broadphase> createBroadphase(BroadphaseType type, float radius) {
+    switch (type) {
+    case BroadphaseType::Grid:
+        return std::unique_ptr<Broadphase>(new BroadphaseAdapter<UniformGrid>(2.0f * radius));
+    case BroadphaseType::Sweep:
+        return std::unique_ptr<Broadphase>(new BroadphaseAdapter<SweepAndPrune>());
+    case BroadphaseType::Dynamic:
+        return std::unique_ptr<Broadphase>(new BroadphaseAdapter<DynamicTree>());
+    case BroadphaseType::Verlet:
+        return std::unique_ptr<Broadphase>(new BroadphaseAdapter<VerletList>(2.0f * radius));
+    case BroadphaseType::Hierarchical:
+        return std::unique_ptr<Broadphase>(new BroadphaseAdapter<HierarchicalGrid>(radius));
+    case BroadphaseType::AsyncTree:
+        return std::unique_ptr<Broadphase>(new BroadphaseAdapter<AsyncBVH>());
+    default:
+        return std::unique_ptr<Broadphase>(new BroadphaseAdapter<BVH>());
+    }
+}
+
+#endif
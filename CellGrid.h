@@ -0,0 +1,202 @@
+#ifndef CELL_GRID_H
+#define CELL_GRID_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "FrameArena.h"
+#include "Parallel.h"
+
+// Square cells over a set of points, shared by UniformGrid and the levels of HierarchicalGrid.
+// Points are binned with a stable radix sort, so every cell owns a contiguous run of slots
+// described by cellStart/cellCount, and slot s holds item sortedIndices[s] at sortedPositions[s].
+// Buffers are only grown, never released, and the sort scratch comes from the frame arena, so
+// rebuilding every frame does not allocate once they are large enough.
+
+class CellGrid {
+public:
+    float cellSize;  // Requested cell edge
+    float cellWidth; // Cell edge used by the last build, larger than cellSize if the grid was capped
+    int columns, rows;
+    float originX, originY;
+
+    std::vector<uint32_t> cellStart;        // First slot of every cell
+    std::vector<uint32_t> cellCount;        // Number of slots in every cell
+    std::vector<uint32_t> sortedIndices;    // Item of every slot, grouped by cell
+    std::vector<glm::vec2> sortedPositions; // Item positions in the same order
+
+    CellGrid(float cellSize = 0.1f)
+        : cellSize(cellSize), cellWidth(cellSize), columns(0), rows(0), originX(0.0f), originY(0.0f) {}
+
+    // Empties the grid, keeping its memory
+    void clear() {
+        columns = rows = 0;
+        cellStart.clear();
+        cellCount.clear();
+        sortedIndices.clear();
+        sortedPositions.clear();
+    }
+
+    // Covers the box from minPos to maxPos with cells of cellSize, doubling the cell edge until
+    // at most maxCells cells are needed
+    void fit(const glm::vec2& minPos, const glm::vec2& maxPos, size_t maxCells) {
+        originX = minPos.x;
+        originY = minPos.y;
+        cellWidth = cellSize;
+        while (true) {
+            columns = static_cast<int>((maxPos.x - minPos.x) / cellWidth) + 1;
+            rows = static_cast<int>((maxPos.y - minPos.y) / cellWidth) + 1;
+            if (static_cast<size_t>(columns) * rows <= maxCells) {
+                break;
+            }
+            cellWidth *= 2.0f;
+        }
+
+        // Size the cell arrays for the cap, so the grid can change shape without reallocating
+        const size_t cells = static_cast<size_t>(columns) * rows;
+        cellStart.reserve(maxCells);
+        cellCount.reserve(maxCells);
+        cellStart.resize(cells);
+        cellCount.resize(cells);
+    }
+
+    // Bins the items listed in sortedIndices, filled in by the caller after fit, at
+    // positionOf(item). The sort is stable: items keep their listed order inside a cell whatever
+    // the number of workers, so the pair order, and the simulation, is deterministic.
+    template <typename PositionOf>
+    void sort(PositionOf&& positionOf) {
+        const size_t count = sortedIndices.size();
+        const size_t cells = cellStart.size();
+        sortedPositions.resize(count);
+        indexScratch.resize(count);
+
+        // Cell of every item, sorted along with sortedIndices. The scratch is released on return.
+        FrameArena& arena = threadFrameArena();
+        ArenaScope scope(arena);
+        FrameVector<uint32_t> itemCells(count, ArenaAllocator<uint32_t>(arena));
+        FrameVector<uint32_t> cellScratch(count, ArenaAllocator<uint32_t>(arena));
+        FrameVector<uint32_t> radixHistogram{ ArenaAllocator<uint32_t>(arena) };
+
+        const unsigned workers = workerCount(count, 4096);
+        const unsigned cellWorkers = workerCount(cells, 4096);
+
+        parallelFor(count, workers, [&](size_t begin, size_t end, unsigned) {
+            for (size_t i = begin; i < end; ++i) {
+                itemCells[i] = cellOf(positionOf(sortedIndices[i]));
+            }
+        });
+
+        unsigned cellBits = 0;
+        while (cellBits < 32 && (cells - 1) >> cellBits) {
+            ++cellBits;
+        }
+        radixSortPairs(itemCells, sortedIndices, cellScratch, indexScratch, count, cellBits, workers, radixHistogram);
+
+        // Cell ranges from the run boundaries of the sorted cells, every cell is written by one thread
+        parallelFor(cells, cellWorkers, [&](size_t begin, size_t end, unsigned) {
+            std::fill(cellStart.begin() + begin, cellStart.begin() + end, 0u);
+            std::fill(cellCount.begin() + begin, cellCount.begin() + end, 0u);
+        });
+        parallelFor(count, workers, [&](size_t begin, size_t end, unsigned) {
+            for (size_t s = begin; s < end; ++s) {
+                uint32_t cell = itemCells[s];
+                if (s == 0 || itemCells[s - 1] != cell) {
+                    cellStart[cell] = static_cast<uint32_t>(s);
+                }
+                if (s + 1 == count || itemCells[s + 1] != cell) {
+                    cellCount[cell] = static_cast<uint32_t>(s + 1); // End of the run for now
+                }
+                sortedPositions[s] = positionOf(sortedIndices[s]);
+            }
+        });
+        parallelFor(cells, cellWorkers, [&](size_t begin, size_t end, unsigned) {
+            for (size_t c = begin; c < end; ++c) {
+                if (cellCount[c] != 0) {
+                    cellCount[c] -= cellStart[c];
+                }
+            }
+        });
+    }
+
+    int clampColumn(float x) const {
+        return std::min(columns - 1, std::max(0, static_cast<int>(std::floor((x - originX) / cellWidth))));
+    }
+
+    int clampRow(float y) const {
+        return std::min(rows - 1, std::max(0, static_cast<int>(std::floor((y - originY) / cellWidth))));
+    }
+
+    uint32_t cellOf(const glm::vec2& pos) const {
+        return static_cast<uint32_t>(clampRow(pos.y)) * columns + clampColumn(pos.x);
+    }
+
+    // Calls fn(slot) for every slot in the cells covering x in [minX, maxX] and y in [minY, maxY],
+    // clamped to the grid
+    template <typename Fn>
+    void forEachSlot(float minX, float minY, float maxX, float maxY, Fn&& fn) const {
+        if (columns == 0) {
+            return;
+        }
+
+        int minCellX = clampColumn(minX);
+        int maxCellX = clampColumn(maxX);
+        int minCellY = clampRow(minY);
+        int maxCellY = clampRow(maxY);
+        for (int y = minCellY; y <= maxCellY; ++y) {
+            for (int x = minCellX; x <= maxCellX; ++x) {
+                size_t cell = static_cast<size_t>(y) * columns + x;
+                for (uint32_t slot = cellStart[cell]; slot < cellStart[cell] + cellCount[cell]; ++slot) {
+                    fn(slot);
+                }
+            }
+        }
+    }
+
+    // Calls fn(s, t) for every pair of slots in the same or adjacent cells, each pair once.
+    // Each cell is paired with itself and half of its 3x3 neighborhood; the other half is
+    // covered when the neighbor visits this cell.
+    template <typename Fn>
+    void forEachNeighborSlotPair(Fn&& fn) const {
+        static const int forwardNeighbors[4][2] = { { 1, 0 }, { -1, 1 }, { 0, 1 }, { 1, 1 } };
+
+        for (int y = 0; y < rows; ++y) {
+            for (int x = 0; x < columns; ++x) {
+                size_t cell = static_cast<size_t>(y) * columns + x;
+                uint32_t begin = cellStart[cell];
+                uint32_t end = begin + cellCount[cell];
+                if (begin == end) {
+                    continue;
+                }
+
+                for (uint32_t s = begin; s < end; ++s) {
+                    for (uint32_t t = s + 1; t < end; ++t) {
+                        fn(s, t);
+                    }
+                }
+
+                for (const auto& offset : forwardNeighbors) {
+                    int nx = x + offset[0];
+                    int ny = y + offset[1];
+                    if (nx < 0 || nx >= columns || ny >= rows) {
+                        continue;
+                    }
+                    size_t neighbor = static_cast<size_t>(ny) * columns + nx;
+                    uint32_t neighborBegin = cellStart[neighbor];
+                    uint32_t neighborEnd = neighborBegin + cellCount[neighbor];
+                    for (uint32_t s = begin; s < end; ++s) {
+                        for (uint32_t t = neighborBegin; t < neighborEnd; ++t) {
+                            fn(s, t);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    std::vector<uint32_t> indexScratch; // Swapped with sortedIndices by the sort, so it cannot be frame scratch
+};
+
+#endif
@@ -0,0 +1,400 @@
+#ifndef DYNAMIC_TREE_H
+#define DYNAMIC_TREE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+#include "ParticleSystem.h"
+#include "ParticleKernels.h"
+#include "BVH.h"
+
+// Dynamic AABB tree in the style of Box2D's b2DynamicTree.
+// Every proxy stores a fattened box (margin plus predicted motion) and is only reinserted when
+// its tight box leaves the fat one, so an update costs O(moved * log N). Proxies can be created
+// and destroyed at any time, and insertions and removals keep the tree balanced with rotations.
+
+struct DynamicTreeNode {
+    static constexpr uint32_t NullIndex = std::numeric_limits<uint32_t>::max();
+
+    AABB bounds;     // Fat box for leaves, union of the children otherwise
+    uint32_t parent; // Next free node while on the free list
+    uint32_t child1;
+    uint32_t child2;
+    int height;      // 0 for leaves, -1 for free nodes
+    int userData;    // Particle index of a leaf
+
+    bool isLeaf() const {
+        return child1 == NullIndex;
+    }
+};
+
+class DynamicTree {
+public:
+    std::vector<DynamicTreeNode> nodes;
+    uint32_t root;
+
+    float margin;               // Added around the tight box on every side
+    float displacementMultiplier; // Scales the predicted displacement added to the fat box
+
+    // Proxy of every particle handled by updateParticles
+    std::vector<uint32_t> particleProxies;
+
+    // Depth handled without recursion. The rotations keep the tree shallow but not strictly
+    // AVL-balanced, so deeper subtrees are walked recursively.
+    static constexpr int QueryStackSize = 64;
+
+    DynamicTree(float margin = 0.02f, float displacementMultiplier = 4.0f)
+        : root(DynamicTreeNode::NullIndex), margin(margin), displacementMultiplier(displacementMultiplier),
+          freeList(DynamicTreeNode::NullIndex) {}
+
+    // Inserts a proxy for the given tight box and returns its id
+    uint32_t createProxy(const AABB& bounds, int userData) {
+        uint32_t proxy = allocateNode();
+        DynamicTreeNode& node = nodes[proxy];
+        node.bounds = AABB(bounds.minX - margin, bounds.minY - margin, bounds.maxX + margin, bounds.maxY + margin);
+        node.userData = userData;
+        node.height = 0;
+        insertLeaf(proxy);
+        return proxy;
+    }
+
+    void destroyProxy(uint32_t proxy) {
+        removeLeaf(proxy);
+        freeNode(proxy);
+    }
+
+    // Updates a proxy to a new tight box that moved by displacement since the last step.
+    // Returns true if the proxy left its fat box and was reinserted.
+    bool moveProxy(uint32_t proxy, const AABB& bounds, const glm::vec2& displacement) {
+        AABB fat(bounds.minX - margin, bounds.minY - margin, bounds.maxX + margin, bounds.maxY + margin);
+        glm::vec2 d = displacementMultiplier * displacement;
+        if (d.x < 0.0f) {
+            fat.minX += d.x;
+        } else {
+            fat.maxX += d.x;
+        }
+        if (d.y < 0.0f) {
+            fat.minY += d.y;
+        } else {
+            fat.maxY += d.y;
+        }
+
+        const AABB& treeBounds = nodes[proxy].bounds;
+        if (treeBounds.contains(bounds)) {
+            // Still inside, unless the fat box has become far too large for the motion
+            AABB huge(fat.minX - 4.0f * margin, fat.minY - 4.0f * margin,
+                      fat.maxX + 4.0f * margin, fat.maxY + 4.0f * margin);
+            if (huge.contains(treeBounds)) {
+                return false;
+            }
+        }
+
+        removeLeaf(proxy);
+        nodes[proxy].bounds = fat;
+        insertLeaf(proxy);
+        return true;
+    }
+
+    // Creates, destroys and moves proxies so that proxy i tracks particle i
+    void sync(const ParticleSystem& particles, float deltaTime) {
+        while (particleProxies.size() > particles.size()) {
+            destroyProxy(particleProxies.back());
+            particleProxies.pop_back();
+        }
+        for (size_t i = 0; i < particles.size(); ++i) {
+            AABB bounds = BVH::particleAABB(particles.position(i));
+            if (i == particleProxies.size()) {
+                particleProxies.push_back(createProxy(bounds, static_cast<int>(i)));
+            } else {
+                moveProxy(particleProxies[i], bounds, particles.velocity(i) * deltaTime);
+            }
+        }
+    }
+
+    void updateParticles(ParticleSystem& particles, float deltaTime) {
+        integrateParticles(particles, deltaTime);
+        sync(particles, deltaTime);
+    }
+
+    // Calls visitor(userData) for every proxy whose fat box overlaps queryBounds
+    template <typename Visitor>
+    void query(const AABB& queryBounds, Visitor&& visitor) const {
+        if (root == DynamicTreeNode::NullIndex) {
+            return;
+        }
+        queryFrom(root, queryBounds, visitor);
+    }
+
+    // Collects the particle pairs whose fat boxes overlap as (i, j) with i < j
+    void findOverlappingPairs(std::vector<std::pair<int, int>>& pairs) const {
+        pairs.clear();
+        for (size_t i = 0; i < particleProxies.size(); ++i) {
+            int self = static_cast<int>(i);
+            query(nodes[particleProxies[i]].bounds, [&pairs, self](int other) {
+                if (other > self) {
+                    pairs.emplace_back(self, other);
+                }
+            });
+        }
+    }
+
+    int height() const {
+        return root == DynamicTreeNode::NullIndex ? 0 : nodes[root].height;
+    }
+
+private:
+    uint32_t freeList;
+
+    template <typename Visitor>
+    void queryFrom(uint32_t start, const AABB& queryBounds, Visitor& visitor) const {
+        uint32_t stack[QueryStackSize];
+        int stackSize = 0;
+        stack[stackSize++] = start;
+        while (stackSize > 0) {
+            const DynamicTreeNode& node = nodes[stack[--stackSize]];
+            if (!node.bounds.overlaps(queryBounds)) {
+                continue;
+            }
+            if (node.isLeaf()) {
+                visitor(node.userData);
+            } else if (stackSize + 2 <= QueryStackSize) {
+                stack[stackSize++] = node.child2;
+                stack[stackSize++] = node.child1;
+            } else {
+                // Only badly unbalanced trees get this deep, continue on a fresh stack
+                queryFrom(node.child1, queryBounds, visitor);
+                queryFrom(node.child2, queryBounds, visitor);
+            }
+        }
+    }
+
+    uint32_t allocateNode() {
+        uint32_t index;
+        if (freeList != DynamicTreeNode::NullIndex) {
+            index = freeList;
+            freeList = nodes[index].parent;
+        } else {
+            index = static_cast<uint32_t>(nodes.size());
+            nodes.emplace_back();
+        }
+        DynamicTreeNode& node = nodes[index];
+        node.parent = DynamicTreeNode::NullIndex;
+        node.child1 = DynamicTreeNode::NullIndex;
+        node.child2 = DynamicTreeNode::NullIndex;
+        node.height = 0;
+        node.userData = -1;
+        return index;
+    }
+
+    void freeNode(uint32_t index) {
+        nodes[index].parent = freeList;
+        nodes[index].height = -1;
+        freeList = index;
+    }
+
+    static AABB combine(const AABB& a, const AABB& b) {
+        AABB result = a;
+        result.expand(b);
+        return result;
+    }
+
+    // Recomputes the box and height of a node from its children
+    void fixNode(uint32_t index) {
+        DynamicTreeNode& node = nodes[index];
+        node.height = 1 + std::max(nodes[node.child1].height, nodes[node.child2].height);
+        node.bounds = combine(nodes[node.child1].bounds, nodes[node.child2].bounds);
+    }
+
+    void insertLeaf(uint32_t leaf) {
+        if (root == DynamicTreeNode::NullIndex) {
+            root = leaf;
+            nodes[root].parent = DynamicTreeNode::NullIndex;
+            return;
+        }
+
+        // Find the best sibling by descending along the cheapest perimeter increase
+        AABB leafBounds = nodes[leaf].bounds;
+        uint32_t index = root;
+        while (!nodes[index].isLeaf()) {
+            const DynamicTreeNode& node = nodes[index];
+            float perimeter = node.bounds.perimeter();
+            float combinedPerimeter = combine(node.bounds, leafBounds).perimeter();
+
+            // Cost of making a new parent for this node and the leaf
+            float cost = 2.0f * combinedPerimeter;
+            // Minimum cost of pushing the leaf further down the tree
+            float inheritanceCost = 2.0f * (combinedPerimeter - perimeter);
+
+            float cost1 = descendCost(node.child1, leafBounds) + inheritanceCost;
+            float cost2 = descendCost(node.child2, leafBounds) + inheritanceCost;
+            if (cost < cost1 && cost < cost2) {
+                break;
+            }
+            index = (cost1 < cost2) ? node.child1 : node.child2;
+        }
+
+        uint32_t sibling = index;
+        uint32_t oldParent = nodes[sibling].parent;
+        uint32_t newParent = allocateNode();
+        nodes[newParent].parent = oldParent;
+        nodes[newParent].bounds = combine(leafBounds, nodes[sibling].bounds);
+        nodes[newParent].height = nodes[sibling].height + 1;
+        nodes[newParent].child1 = sibling;
+        nodes[newParent].child2 = leaf;
+        nodes[sibling].parent = newParent;
+        nodes[leaf].parent = newParent;
+
+        if (oldParent != DynamicTreeNode::NullIndex) {
+            if (nodes[oldParent].child1 == sibling) {
+                nodes[oldParent].child1 = newParent;
+            } else {
+                nodes[oldParent].child2 = newParent;
+            }
+        } else {
+            root = newParent;
+        }
+
+        // Walk back up, rebalancing and refitting the ancestors
+        index = nodes[leaf].parent;
+        while (index != DynamicTreeNode::NullIndex) {
+            index = balance(index);
+            fixNode(index);
+            index = nodes[index].parent;
+        }
+    }
+
+    float descendCost(uint32_t child, const AABB& leafBounds) const {
+        const DynamicTreeNode& node = nodes[child];
+        float combinedPerimeter = combine(leafBounds, node.bounds).perimeter();
+        return node.isLeaf() ? combinedPerimeter : combinedPerimeter - node.bounds.perimeter();
+    }
+
+    void removeLeaf(uint32_t leaf) {
+        if (leaf == root) {
+            root = DynamicTreeNode::NullIndex;
+            return;
+        }
+
+        uint32_t parent = nodes[leaf].parent;
+        uint32_t grandParent = nodes[parent].parent;
+        uint32_t sibling = (nodes[parent].child1 == leaf) ? nodes[parent].child2 : nodes[parent].child1;
+
+        if (grandParent == DynamicTreeNode::NullIndex) {
+            root = sibling;
+            nodes[sibling].parent = DynamicTreeNode::NullIndex;
+            freeNode(parent);
+            return;
+        }
+
+        // Replace the parent by the sibling and refit the ancestors
+        if (nodes[grandParent].child1 == parent) {
+            nodes[grandParent].child1 = sibling;
+        } else {
+            nodes[grandParent].child2 = sibling;
+        }
+        nodes[sibling].parent = grandParent;
+        freeNode(parent);
+
+        uint32_t index = grandParent;
+        while (index != DynamicTreeNode::NullIndex) {
+            index = balance(index);
+            fixNode(index);
+            index = nodes[index].parent;
+        }
+    }
+
+    // Performs a left or right rotation if node A is imbalanced and returns the new subtree root
+    uint32_t balance(uint32_t iA) {
+        DynamicTreeNode& A = nodes[iA];
+        if (A.isLeaf() || A.height < 2) {
+            return iA;
+        }
+
+        uint32_t iB = A.child1;
+        uint32_t iC = A.child2;
+        DynamicTreeNode& B = nodes[iB];
+        DynamicTreeNode& C = nodes[iC];
+        int balanceFactor = C.height - B.height;
+
+        if (balanceFactor > 1) {
+            // Rotate C up
+            uint32_t iF = C.child1;
+            uint32_t iG = C.child2;
+            DynamicTreeNode& F = nodes[iF];
+            DynamicTreeNode& G = nodes[iG];
+
+            C.child1 = iA;
+            C.parent = A.parent;
+            A.parent = iC;
+            replaceChild(C.parent, iA, iC);
+
+            if (F.height > G.height) {
+                C.child2 = iF;
+                A.child2 = iG;
+                G.parent = iA;
+                A.bounds = combine(B.bounds, G.bounds);
+                C.bounds = combine(A.bounds, F.bounds);
+                A.height = 1 + std::max(B.height, G.height);
+                C.height = 1 + std::max(A.height, F.height);
+            } else {
+                C.child2 = iG;
+                A.child2 = iF;
+                F.parent = iA;
+                A.bounds = combine(B.bounds, F.bounds);
+                C.bounds = combine(A.bounds, G.bounds);
+                A.height = 1 + std::max(B.height, F.height);
+                C.height = 1 + std::max(A.height, G.height);
+            }
+            return iC;
+        }
+
+        if (balanceFactor < -1) {
+            // Rotate B up
+            uint32_t iD = B.child1;
+            uint32_t iE = B.child2;
+            DynamicTreeNode& D = nodes[iD];
+            DynamicTreeNode& E = nodes[iE];
+
+            B.child1 = iA;
+            B.parent = A.parent;
+            A.parent = iB;
+            replaceChild(B.parent, iA, iB);
+
+            if (D.height > E.height) {
+                B.child2 = iD;
+                A.child1 = iE;
+                E.parent = iA;
+                A.bounds = combine(C.bounds, E.bounds);
+                B.bounds = combine(A.bounds, D.bounds);
+                A.height = 1 + std::max(C.height, E.height);
+                B.height = 1 + std::max(A.height, D.height);
+            } else {
+                B.child2 = iE;
+                A.child1 = iD;
+                D.parent = iA;
+                A.bounds = combine(C.bounds, D.bounds);
+                B.bounds = combine(A.bounds, E.bounds);
+                A.height = 1 + std::max(C.height, D.height);
+                B.height = 1 + std::max(A.height, E.height);
+            }
+            return iB;
+        }
+
+        return iA;
+    }
+
+    // Points parent (or the root) at newChild instead of oldChild
+    void replaceChild(uint32_t parent, uint32_t oldChild, uint32_t newChild) {
+        if (parent == DynamicTreeNode::NullIndex) {
+            root = newChild;
+        } else if (nodes[parent].child1 == oldChild) {
+            nodes[parent].child1 = newChild;
+        } else {
+            nodes[parent].child2 = newChild;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Monotonic arena for scratch memory that only lives for one simulation step.
+// Allocation bumps an offset into one block and deallocation does nothing; reset() releases
+// everything at once at the end of the step. A step that runs out of space falls back to extra
+// heap blocks, and the next reset() replaces them with a single block large enough for the
+// whole step, so a steady workload stops touching the heap after the first few steps.
+
+class FrameArena {
+public:
+    explicit FrameArena(size_t capacity = 64 * 1024)
+        : capacity(capacity), used(0), overflowBytes(0), peak(0), block(new unsigned char[capacity]) {}
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t)) {
+        uintptr_t base = reinterpret_cast<uintptr_t>(block.get());
+        uintptr_t start = (base + used + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+        size_t end = static_cast<size_t>(start - base) + bytes;
+        if (end <= capacity) {
+            used = end;
+            peak = std::max(peak, used + overflowBytes);
+            return reinterpret_cast<void*>(start);
+        }
+
+        // Out of space for this step, take the memory from the heap until the next reset
+        overflowBlocks.emplace_back(new unsigned char[bytes + alignment]);
+        overflowBytes += bytes + alignment;
+        peak = std::max(peak, used + overflowBytes);
+        uintptr_t overflow = reinterpret_cast<uintptr_t>(overflowBlocks.back().get());
+        return reinterpret_cast<void*>((overflow + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1));
+    }
+
+    template <typename T>
+    T* allocateArray(size_t count) {
+        return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    // Releases everything allocated since the last reset
+    void reset() {
+        if (!overflowBlocks.empty()) {
+            capacity = std::max(2 * capacity, peak);
+            block.reset(new unsigned char[capacity]);
+            overflowBlocks.clear();
+        }
+        used = 0;
+        overflowBytes = 0;
+    }
+
+    // Scoped use inside a step: everything allocated after mark() is released by rewind()
+    size_t mark() const {
+        return used;
+    }
+
+    void rewind(size_t mark) {
+        used = mark;
+    }
+
+    size_t bytesUsed() const {
+        return used + overflowBytes;
+    }
+
+    size_t peakBytes() const {
+        return peak;
+    }
+
+private:
+    size_t capacity;
+    size_t used;
+    size_t overflowBytes;
+    size_t peak; // Largest footprint of any step so far
+    std::unique_ptr<unsigned char[]> block;
+    std::vector<std::unique_ptr<unsigned char[]>> overflowBlocks;
+};
+
+// Rewinds the arena to where it was when the scope was entered
+class ArenaScope {
+public:
+    explicit ArenaScope(FrameArena& arena) : arena(arena), start(arena.mark()) {}
+    ~ArenaScope() { arena.rewind(start); }
+
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+
+private:
+    FrameArena& arena;
+    size_t start;
+};
+
+// Standard allocator drawing from a FrameArena, so containers can use it as scratch
+template <typename T>
+struct ArenaAllocator {
+    typedef T value_type;
+
+    FrameArena* arena;
+
+    explicit ArenaAllocator(FrameArena& arena) : arena(&arena) {}
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t count) {
+        return arena->allocateArray<T>(count);
+    }
+
+    void deallocate(T*, size_t) {} // Released wholesale by reset or rewind
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const {
+        return arena == other.arena;
+    }
+
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const {
+        return arena != other.arena;
+    }
+};
+
+template <typename T>
+using FrameVector = std::vector<T, ArenaAllocator<T>>;
+
+// Arena of the calling thread, for scratch of builds and queries that should not own a buffer.
+// Users rewind it with an ArenaScope; the thread running the steps resets it after every step,
+// other threads after every job that used it.
+inline FrameArena& threadFrameArena() {
+    thread_local FrameArena arena;
+    return arena;
+}
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef HIERARCHICAL_GRID_H
+#define HIERARCHICAL_GRID_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "ParticleSystem.h"
+#include "ParticleKernels.h"
+#include "BVH.h"
+#include "CellGrid.h"
+
+// Hierarchical grid broadphase for particles of different sizes.
+// Level L has cells of edge baseCell * 2^L, where baseCell is the smallest particle diameter,
+// and every particle goes into the finest level whose cells are at least its diameter. Every
+// level is a CellGrid: pairs inside a level come from adjacent cells, and pairs across levels are
+// found by looking up every particle in the 3x3 neighborhood of its cell on each coarser,
+// non-empty level.
+// The work per particle grows with the number of levels, log2 of the size ratio, not with N.
+
+class HierarchicalGrid {
+public:
+    // cellSize is the largest particle diameter the level holds
+    struct Level : CellGrid {
+        std::vector<float> sortedRadii; // Particle radii in the order of sortedIndices
+
+        Level() : CellGrid(0.0f) {}
+    };
+
+    float defaultRadius;
+    std::vector<float> radii; // Radius of every particle, missing entries are set to defaultRadius
+
+    std::vector<Level> levels;         // Finest level first
+    std::vector<uint32_t> activeLevels; // Indices of the non-empty levels, finest first
+    std::vector<uint32_t> particleLevels;
+    float baseCell;
+
+    HierarchicalGrid(float defaultRadius = 0.05f)
+        : defaultRadius(defaultRadius), baseCell(0.0f) {}
+
+    void build(const ParticleSystem& particles) {
+        const size_t count = particles.size();
+        radii.resize(count, defaultRadius);
+        particleLevels.resize(count);
+        activeLevels.clear();
+        if (count == 0) {
+            return;
+        }
+
+        glm::vec2 minPos = particles.position(0);
+        float minRadius = radii[0];
+        for (size_t i = 0; i < count; ++i) {
+            minPos = glm::min(minPos, particles.position(i));
+            minRadius = std::min(minRadius, radii[i]);
+        }
+        baseCell = std::max(2.0f * minRadius, 1e-6f);
+
+        // Assign levels and count their members
+        uint32_t levelCount = 0;
+        for (size_t i = 0; i < count; ++i) {
+            uint32_t level = 0;
+            float cell = baseCell;
+            while (cell < 2.0f * radii[i]) {
+                cell *= 2.0f;
+                ++level;
+            }
+            particleLevels[i] = level;
+            levelCount = std::max(levelCount, level + 1);
+        }
+        if (levels.size() < levelCount) {
+            levels.resize(levelCount);
+        }
+        levelSizes.assign(levelCount, 0);
+        levelMax.assign(levelCount, minPos);
+        for (size_t i = 0; i < count; ++i) {
+            uint32_t level = particleLevels[i];
+            levelMax[level] = levelSizes[level] == 0 ? particles.position(i)
+                                                     : glm::max(levelMax[level], particles.position(i));
+            ++levelSizes[level];
+        }
+
+        // Size every non-empty level, coarsening it if its particles span too many cells
+        float cell = baseCell;
+        for (uint32_t l = 0; l < levelCount; ++l, cell *= 2.0f) {
+            Level& level = levels[l];
+            level.cellSize = cell;
+            if (levelSizes[l] == 0) {
+                level.clear();
+                continue;
+            }
+            activeLevels.push_back(l);
+            level.fit(minPos, levelMax[l], std::max<size_t>(64, 4 * levelSizes[l]));
+            level.sortedIndices.clear();
+            level.sortedIndices.reserve(levelSizes[l]);
+        }
+
+        // List the particles of every level in index order, then sort every level by cell
+        for (size_t i = 0; i < count; ++i) {
+            levels[particleLevels[i]].sortedIndices.push_back(static_cast<uint32_t>(i));
+        }
+        for (uint32_t l : activeLevels) {
+            Level& level = levels[l];
+            level.sort([&particles](uint32_t i) { return particles.position(i); });
+            level.sortedRadii.resize(level.sortedIndices.size());
+            for (size_t s = 0; s < level.sortedIndices.size(); ++s) {
+                level.sortedRadii[s] = radii[level.sortedIndices[s]];
+            }
+        }
+    }
+
+    void updateParticles(ParticleSystem& particles, float deltaTime) {
+        integrateParticles(particles, deltaTime);
+        build(particles);
+    }
+
+    // Calls visitor(particleIndex) for every particle whose box, center +- radius, overlaps queryBounds
+    template <typename Visitor>
+    void query(const AABB& queryBounds, Visitor&& visitor) const {
+        for (uint32_t l : activeLevels) {
+            const Level& level = levels[l];
+            // Boxes stick out of their cell by at most half the level's cell size
+            float reach = 0.5f * level.cellSize;
+            level.forEachSlot(queryBounds.minX - reach, queryBounds.minY - reach,
+                              queryBounds.maxX + reach, queryBounds.maxY + reach, [&](uint32_t slot) {
+                const glm::vec2& pos = level.sortedPositions[slot];
+                float r = level.sortedRadii[slot];
+                if (pos.x + r >= queryBounds.minX && pos.x - r <= queryBounds.maxX &&
+                    pos.y + r >= queryBounds.minY && pos.y - r <= queryBounds.maxY) {
+                    visitor(static_cast<int>(level.sortedIndices[slot]));
+                }
+            });
+        }
+    }
+
+    // Collects every pair of particles whose boxes, center +- radius, overlap as (i, j) with
+    // i < j, each pair once. pairs is cleared and refilled.
+    void findOverlappingPairs(std::vector<std::pair<int, int>>& pairs) const {
+        pairs.clear();
+        for (size_t a = 0; a < activeLevels.size(); ++a) {
+            const Level& level = levels[activeLevels[a]];
+
+            // Pairs inside the level
+            level.forEachNeighborSlotPair([&](uint32_t s, uint32_t t) {
+                testPair(level, s, level, t, pairs);
+            });
+
+            // Pairs with larger particles: their cells are at least r_i + r_j wide, so the
+            // 3x3 neighborhood of the coarser cell holding this particle's center covers them
+            for (uint32_t s = 0; s < level.sortedIndices.size(); ++s) {
+                const glm::vec2& pos = level.sortedPositions[s];
+                for (size_t b = a + 1; b < activeLevels.size(); ++b) {
+                    const Level& coarse = levels[activeLevels[b]];
+                    int cx = coarse.clampColumn(pos.x);
+                    int cy = coarse.clampRow(pos.y);
+                    for (int y = std::max(0, cy - 1); y <= std::min(coarse.rows - 1, cy + 1); ++y) {
+                        for (int x = std::max(0, cx - 1); x <= std::min(coarse.columns - 1, cx + 1); ++x) {
+                            size_t cell = static_cast<size_t>(y) * coarse.columns + x;
+                            for (uint32_t t = coarse.cellStart[cell]; t < coarse.cellStart[cell] + coarse.cellCount[cell]; ++t) {
+                                testPair(level, s, coarse, t, pairs);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    // Build scratch, kept across frames
+    std::vector<uint32_t> levelSizes;
+    std::vector<glm::vec2> levelMax;
+
+    static void testPair(const Level& levelA, uint32_t s, const Level& levelB, uint32_t t,
+                         std::vector<std::pair<int, int>>& pairs) {
+        glm::vec2 delta = levelA.sortedPositions[s] - levelB.sortedPositions[t];
+        float reach = levelA.sortedRadii[s] + levelB.sortedRadii[t];
+        if (std::abs(delta.x) < reach && std::abs(delta.y) < reach) {
+            int i = static_cast<int>(levelA.sortedIndices[s]);
+            int j = static_cast<int>(levelB.sortedIndices[t]);
+            pairs.emplace_back(std::min(i, j), std::max(i, j));
+        }
+    }
+};
+
+#endif
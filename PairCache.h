@@ -0,0 +1,115 @@
+#ifndef PAIR_CACHE_H
+#define PAIR_CACHE_H
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+#include "PairMap.h"
+
+// Persistent per-pair contact state, kept across frames.
+// Entries are keyed by (min(i, j), max(i, j)). A pair is added the first frame the broadphase
+// reports it and removed the first frame it does not. Entries refer to particle indices, so the
+// cache has to be cleared whenever the particles are reordered.
+
+class PairCache {
+public:
+    struct Contact {
+        float impulse;            // Impulse applied at the last contact, for warm starting
+        glm::vec2 normal;         // Last contact normal, pointing from j to i
+        uint32_t age;             // Frames since the broadphase first reported the pair
+        bool touching;            // Result of the last narrowphase test
+        float separation;         // Gap between the particles at the last test, negative if never tested
+        glm::vec2 testedOffset;   // Position of i minus position of j at the last test
+        uint32_t lastFrame;       // Frame in which the broadphase last reported the pair
+
+        Contact()
+            : impulse(0.0f), normal(0.0f), age(0), touching(false), separation(-1.0f),
+              testedOffset(0.0f), lastFrame(0) {}
+
+        // The gap can shrink by at most the relative motion since the last test, so a pair
+        // that was apart and has moved less than its gap is still apart
+        bool canSkip(const glm::vec2& offset) const {
+            if (touching || separation <= 0.0f) {
+                return false;
+            }
+            glm::vec2 motion = offset - testedOffset;
+            return glm::dot(motion, motion) < separation * separation;
+        }
+
+        // Stores the result of a narrowphase test, gap is the distance between the surfaces
+        void record(const glm::vec2& offset, float gap) {
+            testedOffset = offset;
+            separation = gap;
+            touching = gap < 0.0f;
+            if (!touching) {
+                impulse = 0.0f;
+            }
+        }
+    };
+
+    PairMap<Contact> contacts;
+    size_t added;   // Pairs added in the current frame
+    size_t removed; // Pairs removed at the end of the current frame
+
+    PairCache() : added(0), removed(0), frame(0) {}
+
+    void beginFrame() {
+        ++frame;
+        added = 0;
+        removed = 0;
+    }
+
+    // Marks the pair as reported this frame and returns its state, adding it if it is new.
+    // The reference is valid until the next touch.
+    Contact& touch(int i, int j) {
+        auto result = contacts.insert(PairMap<Contact>::pairKey(i, j));
+        Contact& contact = *result.first;
+        if (result.second) {
+            ++added;
+        } else if (contact.lastFrame != frame) {
+            ++contact.age;
+        }
+        contact.lastFrame = frame;
+        return contact;
+    }
+
+    // Removes every pair the broadphase did not report since beginFrame
+    void endFrame() {
+        // Backwards, so the entry moved into an erased position has already been checked
+        for (size_t k = contacts.size(); k-- > 0;) {
+            if (contacts.entries[k].value.lastFrame != frame) {
+                contacts.eraseEntry(k);
+                ++removed;
+            }
+        }
+    }
+
+    // One frame worth of events from a broadphase that reports its full pair list
+    void update(const std::vector<std::pair<int, int>>& pairs) {
+        beginFrame();
+        for (const auto& pair : pairs) {
+            touch(pair.first, pair.second);
+        }
+        endFrame();
+    }
+
+    void remove(int i, int j) {
+        if (contacts.erase(PairMap<Contact>::pairKey(i, j))) {
+            ++removed;
+        }
+    }
+
+    const Contact* find(int i, int j) const {
+        return contacts.find(PairMap<Contact>::pairKey(i, j));
+    }
+
+    void clear() {
+        contacts.clear();
+    }
+
+private:
+    uint32_t frame;
+};
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef PAIR_MAP_H
+#define PAIR_MAP_H
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Hash map from particle pairs to values, for sets of pairs that persist across frames.
+// Entries are stored densely for iteration and found through an open-addressing index with
+// linear probing. Both arrays only grow, so inserting and erasing pairs every frame does not
+// allocate once they are large enough, unlike node-based std::unordered_map.
+// Pointers to values stay valid until the next insert or erase.
+
+template <typename T>
+class PairMap {
+public:
+    struct Entry {
+        uint64_t key;
+        T value;
+    };
+
+    std::vector<Entry> entries; // In no particular order
+
+    PairMap() : mask(0) {}
+
+    static uint64_t pairKey(uint32_t i, uint32_t j) {
+        return (static_cast<uint64_t>(std::min(i, j)) << 32) | std::max(i, j);
+    }
+
+    size_t size() const {
+        return entries.size();
+    }
+
+    T* find(uint64_t key) {
+        if (slots.empty()) {
+            return nullptr;
+        }
+        uint32_t index = slots[findSlot(key)];
+        return index != 0 ? &entries[index - 1].value : nullptr;
+    }
+
+    const T* find(uint64_t key) const {
+        return const_cast<PairMap*>(this)->find(key);
+    }
+
+    // Returns the value of key, value-initialized if it was not present, and whether it was inserted
+    std::pair<T*, bool> insert(uint64_t key) {
+        // Keep the load factor at or below one half
+        if (2 * (entries.size() + 1) > slots.size()) {
+            grow();
+        }
+        size_t slot = findSlot(key);
+        if (slots[slot] != 0) {
+            return std::make_pair(&entries[slots[slot] - 1].value, false);
+        }
+        entries.push_back(Entry{ key, T() });
+        slots[slot] = static_cast<uint32_t>(entries.size());
+        return std::make_pair(&entries.back().value, true);
+    }
+
+    bool erase(uint64_t key) {
+        if (slots.empty()) {
+            return false;
+        }
+        size_t slot = findSlot(key);
+        if (slots[slot] == 0) {
+            return false;
+        }
+        eraseAt(slot);
+        return true;
+    }
+
+    // Erases entries[index]; the last entry takes its place
+    void eraseEntry(size_t index) {
+        eraseAt(findSlot(entries[index].key));
+    }
+
+    void clear() {
+        entries.clear();
+        std::fill(slots.begin(), slots.end(), 0u);
+    }
+
+private:
+    std::vector<uint32_t> slots; // Entry index + 1, 0 for an empty slot
+    size_t mask;
+
+    static size_t hash(uint64_t key) {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        return static_cast<size_t>(key);
+    }
+
+    // Slot holding key, or the empty slot that ends its probe sequence
+    size_t findSlot(uint64_t key) const {
+        size_t slot = hash(key) & mask;
+        while (slots[slot] != 0 && entries[slots[slot] - 1].key != key) {
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    void eraseAt(size_t slot) {
+        size_t index = slots[slot] - 1;
+
+        // Backward-shift deletion: pull later members of the probe run into the gap
+        size_t gap = slot;
+        size_t next = (gap + 1) & mask;
+        while (slots[next] != 0) {
+            size_t home = hash(entries[slots[next] - 1].key) & mask;
+            // The entry may move to the gap unless its home lies cyclically in (gap, next]
+            bool between = gap <= next ? (gap < home && home <= next) : (gap < home || home <= next);
+            if (!between) {
+                slots[gap] = slots[next];
+                gap = next;
+            }
+            next = (next + 1) & mask;
+        }
+        slots[gap] = 0;
+
+        // Fill the hole in the dense array with the last entry
+        size_t last = entries.size() - 1;
+        if (index != last) {
+            slots[findSlot(entries[last].key)] = static_cast<uint32_t>(index + 1);
+            entries[index] = entries[last];
+        }
+        entries.pop_back();
+    }
+
+    void grow() {
+        size_t capacity = std::max<size_t>(16, 2 * slots.size());
+        slots.assign(capacity, 0u);
+        mask = capacity - 1;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            slots[findSlot(entries[i].key)] = static_cast<uint32_t>(i + 1);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Minimal fork-join helpers used by the parallel builders
+
+// Number of workers to use for count items, giving each at least minPerWorker items
+inline unsigned workerCount(size_t count, size_t minPerWorker) {
+    size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+    size_t wanted = count / std::max<size_t>(1, minPerWorker);
+    return static_cast<unsigned>(std::max<size_t>(1, std::min(hardware, wanted)));
+}
+
+// Threads that live for the whole program and run the chunks of parallelFor passes.
+// A build issues several passes in a row, so starting threads per pass would cost more than
+// the short passes themselves; here a pass only wakes the sleeping workers. Submitting a pass
+// does not allocate.
+class WorkerPool {
+public:
+    static WorkerPool& instance() {
+        static WorkerPool pool;
+        return pool;
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Calls fn(begin, end, chunk) for every chunk of [0, count) split into `chunks` parts and
+    // returns once all of them are done. The calling thread takes chunks as well. A pass
+    // submitted from inside a chunk, or while another thread's pass runs, runs its chunks on the
+    // calling thread, so passes never wait on each other. Nested passes are caught by the
+    // per-thread flag before submitMutex is touched, since the thread running the chunk may be
+    // the one holding it.
+    template <typename Fn>
+    void run(size_t count, unsigned chunks, Fn& fn) {
+        std::unique_lock<std::mutex> submit;
+        if (!insideChunk()) {
+            submit = std::unique_lock<std::mutex>(submitMutex, std::try_to_lock);
+        }
+        if (!submit.owns_lock()) {
+            for (unsigned chunk = 0; chunk < chunks; ++chunk) {
+                fn(count * chunk / chunks, count * (chunk + 1) / chunks, chunk);
+            }
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        job.invoke = &invokeChunk<Fn>;
+        job.fn = &fn;
+        job.count = count;
+        job.chunks = chunks;
+        nextChunk = 0;
+        pendingChunks = chunks;
+        lock.unlock();
+        wake.notify_all();
+
+        lock.lock();
+        runChunks(lock);
+        finished.wait(lock, [this]() { return pendingChunks == 0; });
+    }
+
+private:
+    struct Job {
+        void (*invoke)(void* fn, size_t begin, size_t end, unsigned chunk);
+        void* fn;
+        size_t count;
+        unsigned chunks;
+    };
+
+    std::vector<std::thread> threads;
+    std::mutex submitMutex; // Held by the thread whose pass is running
+    std::mutex mutex;       // Guards everything below
+    std::condition_variable wake;
+    std::condition_variable finished;
+    Job job;
+    unsigned nextChunk;     // Next chunk of the current pass to hand out
+    unsigned pendingChunks; // Chunks of the current pass not finished yet
+    bool stopping;
+
+    WorkerPool() : job(), nextChunk(0), pendingChunks(0), stopping(false) {
+        unsigned hardware = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned i = 0; i + 1 < hardware; ++i) {
+            threads.emplace_back([this]() { workerLoop(); });
+        }
+    }
+
+    template <typename Fn>
+    static void invokeChunk(void* fn, size_t begin, size_t end, unsigned chunk) {
+        (*static_cast<Fn*>(fn))(begin, end, chunk);
+    }
+
+    // Whether this thread is running a chunk of a pool pass
+    static bool& insideChunk() {
+        static thread_local bool inside = false;
+        return inside;
+    }
+
+    // Takes chunks of the current pass until none are left. Chunks are claimed under the lock,
+    // so a claimed chunk always belongs to the pass in job.
+    void runChunks(std::unique_lock<std::mutex>& lock) {
+        while (nextChunk < job.chunks) {
+            Job current = job;
+            unsigned chunk = nextChunk++;
+            lock.unlock();
+            insideChunk() = true;
+            current.invoke(current.fn, current.count * chunk / current.chunks,
+                           current.count * (chunk + 1) / current.chunks, chunk);
+            insideChunk() = false;
+            lock.lock();
+            if (--pendingChunks == 0) {
+                finished.notify_all();
+            }
+        }
+    }
+
+    void workerLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this]() { return stopping || nextChunk < job.chunks; });
+            if (stopping) {
+                return;
+            }
+            runChunks(lock);
+        }
+    }
+};
+
+// Splits [0, count) into `workers` contiguous chunks and calls fn(begin, end, worker) for each.
+// Chunk boundaries only depend on count and workers, so consecutive passes over the same
+// range see the same split. The chunks run on the WorkerPool and the calling thread.
+template <typename Fn>
+void parallelFor(size_t count, unsigned workers, Fn&& fn) {
+    if (workers <= 1) {
+        fn(size_t(0), count, 0u);
+        return;
+    }
+    WorkerPool::instance().run(count, workers, fn);
+}
+
+// Stable LSD radix sort of (key, value) pairs by the low keyBits bits of the keys, 11 bits per pass.
+// Every worker histograms its own contiguous block and the offsets are handed out bucket-major,
+// worker-minor, so equal keys keep their input order and the result does not depend on the
+// number of workers. The scratch vectors must hold at least count entries; the sorted pairs end
+// up in keys and values.
+template <typename KeyVector, typename ValueVector, typename Histogram>
+void radixSortPairs(KeyVector& keys, ValueVector& values, KeyVector& keyScratch, ValueVector& valueScratch,
+                    size_t count, unsigned keyBits, unsigned workers, Histogram& histogram) {
+    const unsigned radixBits = 11;
+    const uint32_t bucketCount = 1u << radixBits;
+    histogram.assign(size_t(workers) * bucketCount, 0);
+
+    for (unsigned shift = 0; shift < keyBits; shift += radixBits) {
+        parallelFor(count, workers, [&](size_t begin, size_t end, unsigned worker) {
+            uint32_t* counts = &histogram[size_t(worker) * bucketCount];
+            std::fill(counts, counts + bucketCount, 0u);
+            for (size_t i = begin; i < end; ++i) {
+                ++counts[(keys[i] >> shift) & (bucketCount - 1)];
+            }
+        });
+
+        uint32_t offset = 0;
+        for (uint32_t bucket = 0; bucket < bucketCount; ++bucket) {
+            for (unsigned worker = 0; worker < workers; ++worker) {
+                uint32_t& slot = histogram[size_t(worker) * bucketCount + bucket];
+                uint32_t bucketSize = slot;
+                slot = offset;
+                offset += bucketSize;
+            }
+        }
+
+        parallelFor(count, workers, [&](size_t begin, size_t end, unsigned worker) {
+            uint32_t* offsets = &histogram[size_t(worker) * bucketCount];
+            for (size_t i = begin; i < end; ++i) {
+                uint32_t destination = offsets[(keys[i] >> shift) & (bucketCount - 1)]++;
+                keyScratch[destination] = keys[i];
+                valueScratch[destination] = values[i];
+            }
+        });
+
+        keys.swap(keyScratch);
+        values.swap(valueScratch);
+    }
+}
+
+#endif
@@ -0,0 +1,254 @@
+#ifndef PARTICLE_KERNELS_H
+#define PARTICLE_KERNELS_H
+
+#include <cstddef>
+#include "ParticleSystem.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PARTICLE_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+// Integration and wall kernels over the columns of a ParticleSystem.
+// A step is p += v * dt, then clamping to the box and reflecting the velocity on the axes that
+// hit a wall, with the same arithmetic as integrateParticles for std::vector<Particle>. The vector
+// kernels replace the wall branches with compare masks and blends and always work on whole
+// registers, which the aligned, padded columns allow, so the loop is limited by memory bandwidth
+// rather than by mispredicted branches. Each kernel is compiled for its own instruction set and
+// the widest one the CPU supports is picked at runtime, so no -m flags are needed. Every
+// broadphase integrates through the dispatching integrateParticles at the end of this file.
+// All kernels must round p + v * dt the same way, so none of them may fuse it into an FMA
+// whatever -ffp-contract, -mfma or -march the file is built with: GCC compiles the kernels with
+// fp-contract=off, and on clang every kernel turns contraction off in its body. Clang's
+// -ffp-contract=fast ignores the pragma and is not supported.
+// The kernels agree bit for bit with each other. They agree with integrateParticles for
+// std::vector<Particle> bit for bit too, signed zeros and infinities included, as long as that
+// one is built without contraction, since it follows the build flags; NaNs stay NaN in both but
+// may differ in sign and payload.
+
+#if defined(__clang__)
+#define PARTICLE_KERNEL_NO_CONTRACT _Pragma("clang fp contract(off)")
+#else
+#define PARTICLE_KERNEL_NO_CONTRACT
+#if defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+#define PARTICLE_KERNELS_GCC_OPTIONS
+#endif
+#endif
+
+enum class SimdLevel { Scalar, SSE2, AVX2, AVX512 };
+
+// Reference kernel, one particle at a time
+inline void integrateParticlesScalar(ParticleSystem& system, float deltaTime) {
+    PARTICLE_KERNEL_NO_CONTRACT
+    const float minX = -0.94f, maxX = 0.94f;
+    const float minY = -0.94f, maxY = 0.94f;
+    ParticleColumns columns = system.view(PositionColumn | VelocityColumn);
+    float* posX = columns.posX;
+    float* posY = columns.posY;
+    float* velX = columns.velX;
+    float* velY = columns.velY;
+
+    for (size_t i = 0; i < columns.count; ++i) {
+        float x = posX[i] + velX[i] * deltaTime;
+        float y = posY[i] + velY[i] * deltaTime;
+        float vx = velX[i];
+        float vy = velY[i];
+
+        bool hitX = x < minX || x > maxX;
+        bool hitY = y < minY || y > maxY;
+        if (hitX) {
+            x = x < minX ? minX : maxX;
+            vx = -vx * 0.9f; // Reflect and dampen
+        }
+        if (hitY) {
+            y = y < minY ? minY : maxY;
+            vy = -vy * 0.9f;
+        }
+        if (hitX && hitY) {
+            vx *= 0.9f; // Extra damping to resolve sticking
+            vy *= 0.9f;
+        }
+
+        posX[i] = x;
+        posY[i] = y;
+        velX[i] = vx;
+        velY[i] = vy;
+    }
+}
+
+#if defined(PARTICLE_KERNELS_X86)
+
+// Lanes of mask take b, the others a. SSE2 has no blendv.
+__attribute__((target("sse2")))
+inline __m128 selectSSE2(__m128 a, __m128 b, __m128 mask) {
+    return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a));
+}
+
+// The vector kernels reflect with v * -0.9f, which rounds exactly like -v * 0.9f
+__attribute__((target("sse2")))
+inline void integrateParticlesSSE2(ParticleSystem& system, float deltaTime) {
+    PARTICLE_KERNEL_NO_CONTRACT
+    ParticleColumns columns = system.view(PositionColumn | VelocityColumn);
+    const __m128 dt = _mm_set1_ps(deltaTime);
+    const __m128 minBound = _mm_set1_ps(-0.94f);
+    const __m128 maxBound = _mm_set1_ps(0.94f);
+    const __m128 damping = _mm_set1_ps(0.9f);
+    const __m128 reflect = _mm_set1_ps(-0.9f);
+
+    for (size_t i = 0; i < columns.count; i += 4) {
+        __m128 vx = _mm_load_ps(columns.velX + i);
+        __m128 vy = _mm_load_ps(columns.velY + i);
+        __m128 x = _mm_add_ps(_mm_load_ps(columns.posX + i), _mm_mul_ps(vx, dt));
+        __m128 y = _mm_add_ps(_mm_load_ps(columns.posY + i), _mm_mul_ps(vy, dt));
+
+        __m128 belowX = _mm_cmplt_ps(x, minBound);
+        __m128 aboveX = _mm_cmpgt_ps(x, maxBound);
+        __m128 belowY = _mm_cmplt_ps(y, minBound);
+        __m128 aboveY = _mm_cmpgt_ps(y, maxBound);
+        __m128 hitX = _mm_or_ps(belowX, aboveX);
+        __m128 hitY = _mm_or_ps(belowY, aboveY);
+        __m128 corner = _mm_and_ps(hitX, hitY);
+
+        x = selectSSE2(selectSSE2(x, minBound, belowX), maxBound, aboveX);
+        y = selectSSE2(selectSSE2(y, minBound, belowY), maxBound, aboveY);
+        vx = selectSSE2(vx, _mm_mul_ps(vx, reflect), hitX);
+        vy = selectSSE2(vy, _mm_mul_ps(vy, reflect), hitY);
+        vx = selectSSE2(vx, _mm_mul_ps(vx, damping), corner);
+        vy = selectSSE2(vy, _mm_mul_ps(vy, damping), corner);
+
+        _mm_store_ps(columns.posX + i, x);
+        _mm_store_ps(columns.posY + i, y);
+        _mm_store_ps(columns.velX + i, vx);
+        _mm_store_ps(columns.velY + i, vy);
+    }
+}
+
+__attribute__((target("avx2")))
+inline void integrateParticlesAVX2(ParticleSystem& system, float deltaTime) {
+    PARTICLE_KERNEL_NO_CONTRACT
+    ParticleColumns columns = system.view(PositionColumn | VelocityColumn);
+    const __m256 dt = _mm256_set1_ps(deltaTime);
+    const __m256 minBound = _mm256_set1_ps(-0.94f);
+    const __m256 maxBound = _mm256_set1_ps(0.94f);
+    const __m256 damping = _mm256_set1_ps(0.9f);
+    const __m256 reflect = _mm256_set1_ps(-0.9f);
+
+    for (size_t i = 0; i < columns.count; i += 8) {
+        __m256 vx = _mm256_load_ps(columns.velX + i);
+        __m256 vy = _mm256_load_ps(columns.velY + i);
+        __m256 x = _mm256_add_ps(_mm256_load_ps(columns.posX + i), _mm256_mul_ps(vx, dt));
+        __m256 y = _mm256_add_ps(_mm256_load_ps(columns.posY + i), _mm256_mul_ps(vy, dt));
+
+        __m256 belowX = _mm256_cmp_ps(x, minBound, _CMP_LT_OQ);
+        __m256 aboveX = _mm256_cmp_ps(x, maxBound, _CMP_GT_OQ);
+        __m256 belowY = _mm256_cmp_ps(y, minBound, _CMP_LT_OQ);
+        __m256 aboveY = _mm256_cmp_ps(y, maxBound, _CMP_GT_OQ);
+        __m256 hitX = _mm256_or_ps(belowX, aboveX);
+        __m256 hitY = _mm256_or_ps(belowY, aboveY);
+        __m256 corner = _mm256_and_ps(hitX, hitY);
+
+        x = _mm256_blendv_ps(_mm256_blendv_ps(x, minBound, belowX), maxBound, aboveX);
+        y = _mm256_blendv_ps(_mm256_blendv_ps(y, minBound, belowY), maxBound, aboveY);
+        vx = _mm256_blendv_ps(vx, _mm256_mul_ps(vx, reflect), hitX);
+        vy = _mm256_blendv_ps(vy, _mm256_mul_ps(vy, reflect), hitY);
+        vx = _mm256_blendv_ps(vx, _mm256_mul_ps(vx, damping), corner);
+        vy = _mm256_blendv_ps(vy, _mm256_mul_ps(vy, damping), corner);
+
+        _mm256_store_ps(columns.posX + i, x);
+        _mm256_store_ps(columns.posY + i, y);
+        _mm256_store_ps(columns.velX + i, vx);
+        _mm256_store_ps(columns.velY + i, vy);
+    }
+}
+
+__attribute__((target("avx512f")))
+inline void integrateParticlesAVX512(ParticleSystem& system, float deltaTime) {
+    PARTICLE_KERNEL_NO_CONTRACT
+    ParticleColumns columns = system.view(PositionColumn | VelocityColumn);
+    const __m512 dt = _mm512_set1_ps(deltaTime);
+    const __m512 minBound = _mm512_set1_ps(-0.94f);
+    const __m512 maxBound = _mm512_set1_ps(0.94f);
+    const __m512 damping = _mm512_set1_ps(0.9f);
+    const __m512 reflect = _mm512_set1_ps(-0.9f);
+
+    for (size_t i = 0; i < columns.count; i += 16) {
+        __m512 vx = _mm512_load_ps(columns.velX + i);
+        __m512 vy = _mm512_load_ps(columns.velY + i);
+        __m512 x = _mm512_add_ps(_mm512_load_ps(columns.posX + i), _mm512_mul_ps(vx, dt));
+        __m512 y = _mm512_add_ps(_mm512_load_ps(columns.posY + i), _mm512_mul_ps(vy, dt));
+
+        __mmask16 belowX = _mm512_cmp_ps_mask(x, minBound, _CMP_LT_OQ);
+        __mmask16 aboveX = _mm512_cmp_ps_mask(x, maxBound, _CMP_GT_OQ);
+        __mmask16 belowY = _mm512_cmp_ps_mask(y, minBound, _CMP_LT_OQ);
+        __mmask16 aboveY = _mm512_cmp_ps_mask(y, maxBound, _CMP_GT_OQ);
+        __mmask16 hitX = belowX | aboveX;
+        __mmask16 hitY = belowY | aboveY;
+        __mmask16 corner = hitX & hitY;
+
+        x = _mm512_mask_blend_ps(aboveX, _mm512_mask_blend_ps(belowX, x, minBound), maxBound);
+        y = _mm512_mask_blend_ps(aboveY, _mm512_mask_blend_ps(belowY, y, minBound), maxBound);
+        vx = _mm512_mask_mul_ps(vx, hitX, vx, reflect);
+        vy = _mm512_mask_mul_ps(vy, hitY, vy, reflect);
+        vx = _mm512_mask_mul_ps(vx, corner, vx, damping);
+        vy = _mm512_mask_mul_ps(vy, corner, vy, damping);
+
+        _mm512_store_ps(columns.posX + i, x);
+        _mm512_store_ps(columns.posY + i, y);
+        _mm512_store_ps(columns.velX + i, vx);
+        _mm512_store_ps(columns.velY + i, vy);
+    }
+}
+
+#endif
+
+#if defined(PARTICLE_KERNELS_GCC_OPTIONS)
+#pragma GCC pop_options
+#undef PARTICLE_KERNELS_GCC_OPTIONS
+#endif
+
+// Widest kernel the CPU and OS support
+inline SimdLevel detectSimdLevel() {
+#if defined(PARTICLE_KERNELS_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return SimdLevel::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return SimdLevel::SSE2;
+    }
+#endif
+    return SimdLevel::Scalar;
+}
+
+// Kernel used by integrateParticles, detected on first use. It may be lowered, e.g. to compare
+// against the scalar reference, but never raised above what detectSimdLevel returns.
+inline SimdLevel& particleSimdLevel() {
+    static SimdLevel level = detectSimdLevel();
+    return level;
+}
+
+inline void integrateParticles(ParticleSystem& system, float deltaTime) {
+    switch (particleSimdLevel()) {
+#if defined(PARTICLE_KERNELS_X86)
+    case SimdLevel::AVX512:
+        integrateParticlesAVX512(system, deltaTime);
+        return;
+    case SimdLevel::AVX2:
+        integrateParticlesAVX2(system, deltaTime);
+        return;
+    case SimdLevel::SSE2:
+        integrateParticlesSSE2(system, deltaTime);
+        return;
+#endif
+    default:
+        integrateParticlesScalar(system, deltaTime);
+        return;
+    }
+}
+
+#endif
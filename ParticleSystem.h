@@ -0,0 +1,464 @@
+#ifndef PARTICLE_SYSTEM_H
+#define PARTICLE_SYSTEM_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+#include "particle.h"
+
+// Structure-of-arrays particle storage.
+// Every attribute lives in its own array, so a loop over positions and velocities streams
+// 16 bytes per particle instead of the whole 20-byte Particle record. The arrays start on a
+// cache line and their capacity is a whole number of 16-float SIMD registers, with the padding
+// zeroed, so vector kernels can run over full registers without a scalar tail.
+// The simulation and the broadphases work on it directly; Particle is only the value type
+// particles are created from and copied out as.
+// The kinematic columns are always stored. Optional attributes are declared with enableColumns,
+// usually once at startup, and a column that is not enabled has no array at all.
+
+// Growable array aligned to a cache line. T must be trivially copyable.
+template <typename T>
+class AlignedArray {
+public:
+    static constexpr size_t Alignment = 64;
+    static constexpr size_t Padding = 16; // Capacity granularity, one AVX-512 register of floats
+
+    AlignedArray() : elements(nullptr), count(0), capacity(0) {}
+
+    AlignedArray(const AlignedArray& other) : elements(nullptr), count(0), capacity(0) {
+        *this = other;
+    }
+
+    AlignedArray& operator=(const AlignedArray& other) {
+        if (this != &other) {
+            resize(other.count);
+            if (other.count > 0) {
+                std::memcpy(elements, other.elements, other.count * sizeof(T));
+            }
+        }
+        return *this;
+    }
+
+    ~AlignedArray() {
+        release(elements);
+    }
+
+    // Empties the array and frees its memory
+    void reset() {
+        release(elements);
+        elements = nullptr;
+        count = 0;
+        capacity = 0;
+    }
+
+    size_t size() const { return count; }
+    T* data() { return elements; }
+    const T* data() const { return elements; }
+    T& operator[](size_t i) { return elements[i]; }
+    const T& operator[](size_t i) const { return elements[i]; }
+
+    void reserve(size_t wanted) {
+        if (wanted <= capacity) {
+            return;
+        }
+        size_t newCapacity = (wanted + Padding - 1) / Padding * Padding;
+        T* grown = static_cast<T*>(::operator new(newCapacity * sizeof(T), std::align_val_t(Alignment)));
+        if (count > 0) {
+            std::memcpy(grown, elements, count * sizeof(T));
+        }
+        std::memset(static_cast<void*>(grown + count), 0, (newCapacity - count) * sizeof(T));
+        release(elements);
+        elements = grown;
+        capacity = newCapacity;
+    }
+
+    // New elements are zero, like the padding
+    void resize(size_t newCount) {
+        if (newCount > capacity) {
+            reserve(std::max(newCount, 2 * capacity));
+        }
+        if (newCount < count) {
+            std::memset(static_cast<void*>(elements + newCount), 0, (count - newCount) * sizeof(T));
+        }
+        count = newCount;
+    }
+
+    void push_back(const T& value) {
+        resize(count + 1);
+        elements[count - 1] = value;
+    }
+
+    void swap(AlignedArray& other) {
+        std::swap(elements, other.elements);
+        std::swap(count, other.count);
+        std::swap(capacity, other.capacity);
+    }
+
+private:
+    T* elements;
+    size_t count;
+    size_t capacity;
+
+    static void release(T* memory) {
+        if (memory) {
+            ::operator delete(memory, std::align_val_t(Alignment));
+        }
+    }
+};
+
+// Per-particle attributes, combined into a ColumnMask
+enum ParticleColumn : uint32_t {
+    PositionColumn = 1u << 0,
+    VelocityColumn = 1u << 1,
+    MassColumn = 1u << 2, // Mass and inverse mass
+    IdColumn = 1u << 3,
+    ColorColumn = 1u << 4, // Packed RGBA8
+    SpeciesColumn = 1u << 5,
+    TemperatureColumn = 1u << 6,
+    UserDataColumn = 1u << 7,
+};
+
+typedef uint32_t ColumnMask;
+
+const ColumnMask KinematicColumns = PositionColumn | VelocityColumn | MassColumn;
+const ColumnMask OptionalColumns = IdColumn | ColorColumn | SpeciesColumn | TemperatureColumn | UserDataColumn;
+
+// Raw arrays handed to a kernel. Columns the kernel did not request, or that are not enabled,
+// are null, so a kernel cannot touch more than it asked for.
+struct ParticleColumns {
+    size_t count;
+    float* posX;
+    float* posY;
+    float* velX;
+    float* velY;
+    float* mass;
+    float* invMass;
+    uint32_t* id;
+    uint32_t* color;
+    uint16_t* species;
+    float* temperature;
+    uint64_t* userData;
+};
+
+class ParticleSystem;
+
+// AoS-style handle to one particle of a ParticleSystem, with the accessors of Particle
+class ParticleRef {
+public:
+    ParticleRef(ParticleSystem& system, size_t index) : system(system), index(index) {}
+
+    glm::vec2 getPosition() const;
+    glm::vec2 getVelocity() const;
+    float getMass() const;
+    void setPosition(const glm::vec2& position);
+    void setVelocity(const glm::vec2& velocity);
+    void hitBottomTop();
+    void hitLeftRight();
+    void update(float deltaTime);
+    void CollsionResponse(float m2, glm::vec2 v2, glm::vec2 p2, float deltaTime);
+
+    operator Particle() const;
+    ParticleRef& operator=(const Particle& particle);
+
+private:
+    ParticleSystem& system;
+    size_t index;
+};
+
+class ParticleSystem {
+public:
+    AlignedArray<float> posX, posY;
+    AlignedArray<float> velX, velY;
+    AlignedArray<float> mass;
+    AlignedArray<float> invMass; // 0 for particles with no mass
+
+    // Optional columns, empty unless enabled
+    AlignedArray<uint32_t> id;
+    AlignedArray<uint32_t> color;
+    AlignedArray<uint16_t> species;
+    AlignedArray<float> temperature;
+    AlignedArray<uint64_t> userData;
+
+    explicit ParticleSystem(ColumnMask optional = 0) : enabled(KinematicColumns) {
+        enableColumns(optional);
+    }
+
+    size_t size() const {
+        return posX.size();
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    ColumnMask columns() const {
+        return enabled;
+    }
+
+    glm::vec2 position(size_t i) const {
+        return glm::vec2(posX[i], posY[i]);
+    }
+
+    glm::vec2 velocity(size_t i) const {
+        return glm::vec2(velX[i], velY[i]);
+    }
+
+    bool hasColumns(ColumnMask mask) const {
+        return (enabled & mask) == mask;
+    }
+
+    // Adds optional columns, zero-filled for the existing particles
+    void enableColumns(ColumnMask mask) {
+        enabled |= mask & OptionalColumns;
+        resize(size());
+    }
+
+    // Drops optional columns and frees their memory
+    void disableColumns(ColumnMask mask) {
+        mask &= OptionalColumns;
+        enabled &= ~mask;
+        if (mask & IdColumn) {
+            id.reset();
+        }
+        if (mask & ColorColumn) {
+            color.reset();
+        }
+        if (mask & SpeciesColumn) {
+            species.reset();
+        }
+        if (mask & TemperatureColumn) {
+            temperature.reset();
+        }
+        if (mask & UserDataColumn) {
+            userData.reset();
+        }
+    }
+
+    // Arrays for a kernel that works on the requested columns only
+    ParticleColumns view(ColumnMask requested) {
+        ColumnMask mask = requested & enabled;
+        ParticleColumns view;
+        view.count = size();
+        view.posX = mask & PositionColumn ? posX.data() : nullptr;
+        view.posY = mask & PositionColumn ? posY.data() : nullptr;
+        view.velX = mask & VelocityColumn ? velX.data() : nullptr;
+        view.velY = mask & VelocityColumn ? velY.data() : nullptr;
+        view.mass = mask & MassColumn ? mass.data() : nullptr;
+        view.invMass = mask & MassColumn ? invMass.data() : nullptr;
+        view.id = mask & IdColumn ? id.data() : nullptr;
+        view.color = mask & ColorColumn ? color.data() : nullptr;
+        view.species = mask & SpeciesColumn ? species.data() : nullptr;
+        view.temperature = mask & TemperatureColumn ? temperature.data() : nullptr;
+        view.userData = mask & UserDataColumn ? userData.data() : nullptr;
+        return view;
+    }
+
+    void reserve(size_t count) {
+        posX.reserve(count);
+        posY.reserve(count);
+        velX.reserve(count);
+        velY.reserve(count);
+        mass.reserve(count);
+        invMass.reserve(count);
+        if (enabled & IdColumn) {
+            id.reserve(count);
+        }
+        if (enabled & ColorColumn) {
+            color.reserve(count);
+        }
+        if (enabled & SpeciesColumn) {
+            species.reserve(count);
+        }
+        if (enabled & TemperatureColumn) {
+            temperature.reserve(count);
+        }
+        if (enabled & UserDataColumn) {
+            userData.reserve(count);
+        }
+    }
+
+    void clear() {
+        resize(0);
+    }
+
+    void resize(size_t count) {
+        posX.resize(count);
+        posY.resize(count);
+        velX.resize(count);
+        velY.resize(count);
+        mass.resize(count);
+        invMass.resize(count);
+        if (enabled & IdColumn) {
+            id.resize(count);
+        }
+        if (enabled & ColorColumn) {
+            color.resize(count);
+        }
+        if (enabled & SpeciesColumn) {
+            species.resize(count);
+        }
+        if (enabled & TemperatureColumn) {
+            temperature.resize(count);
+        }
+        if (enabled & UserDataColumn) {
+            userData.resize(count);
+        }
+    }
+
+    // Optional columns of the new particle are zero
+    void push_back(const Particle& particle) {
+        resize(size() + 1);
+        (*this)[size() - 1] = particle;
+    }
+
+    ParticleRef operator[](size_t i) {
+        return ParticleRef(*this, i);
+    }
+
+    Particle operator[](size_t i) const {
+        return Particle(mass[i], glm::vec2(posX[i], posY[i]), glm::vec2(velX[i], velY[i]));
+    }
+
+    // Replaces the kinematic columns with a copy of AoS particles, optional columns are zeroed
+    void assign(const std::vector<Particle>& particles) {
+        clear();
+        resize(particles.size());
+        for (size_t i = 0; i < particles.size(); ++i) {
+            (*this)[i] = particles[i];
+        }
+    }
+
+    // Makes this a copy of source in which particle i is source particle order[i], for every
+    // column of source. Memory is reused, so gathering every frame does not allocate.
+    void gather(const ParticleSystem& source, const std::vector<uint32_t>& order) {
+        disableColumns(~source.enabled);
+        enableColumns(source.enabled);
+        resize(order.size());
+        gatherColumn(posX, source.posX, order);
+        gatherColumn(posY, source.posY, order);
+        gatherColumn(velX, source.velX, order);
+        gatherColumn(velY, source.velY, order);
+        gatherColumn(mass, source.mass, order);
+        gatherColumn(invMass, source.invMass, order);
+        if (enabled & IdColumn) {
+            gatherColumn(id, source.id, order);
+        }
+        if (enabled & ColorColumn) {
+            gatherColumn(color, source.color, order);
+        }
+        if (enabled & SpeciesColumn) {
+            gatherColumn(species, source.species, order);
+        }
+        if (enabled & TemperatureColumn) {
+            gatherColumn(temperature, source.temperature, order);
+        }
+        if (enabled & UserDataColumn) {
+            gatherColumn(userData, source.userData, order);
+        }
+    }
+
+    void swap(ParticleSystem& other) {
+        posX.swap(other.posX);
+        posY.swap(other.posY);
+        velX.swap(other.velX);
+        velY.swap(other.velY);
+        mass.swap(other.mass);
+        invMass.swap(other.invMass);
+        id.swap(other.id);
+        color.swap(other.color);
+        species.swap(other.species);
+        temperature.swap(other.temperature);
+        userData.swap(other.userData);
+        std::swap(enabled, other.enabled);
+    }
+
+    // Writes positions, velocities and masses back to AoS particles for code that still needs them
+    void copyTo(std::vector<Particle>& particles) const {
+        if (particles.size() != size()) {
+            particles.clear();
+            for (size_t i = 0; i < size(); ++i) {
+                particles.push_back((*this)[i]);
+            }
+            return;
+        }
+        for (size_t i = 0; i < size(); ++i) {
+            particles[i].mass = mass[i];
+            particles[i].position = glm::vec2(posX[i], posY[i]);
+            particles[i].velocity = glm::vec2(velX[i], velY[i]);
+        }
+    }
+
+private:
+    ColumnMask enabled;
+
+    template <typename T>
+    static void gatherColumn(AlignedArray<T>& to, const AlignedArray<T>& from, const std::vector<uint32_t>& order) {
+        for (size_t i = 0; i < order.size(); ++i) {
+            to[i] = from[order[i]];
+        }
+    }
+};
+
+inline glm::vec2 ParticleRef::getPosition() const {
+    return glm::vec2(system.posX[index], system.posY[index]);
+}
+
+inline glm::vec2 ParticleRef::getVelocity() const {
+    return glm::vec2(system.velX[index], system.velY[index]);
+}
+
+inline float ParticleRef::getMass() const {
+    return system.mass[index];
+}
+
+inline void ParticleRef::setPosition(const glm::vec2& position) {
+    system.posX[index] = position.x;
+    system.posY[index] = position.y;
+}
+
+inline void ParticleRef::setVelocity(const glm::vec2& velocity) {
+    system.velX[index] = velocity.x;
+    system.velY[index] = velocity.y;
+}
+
+inline void ParticleRef::hitBottomTop() {
+    system.velY[index] = -system.velY[index];
+}
+
+inline void ParticleRef::hitLeftRight() {
+    system.velX[index] = -system.velX[index];
+}
+
+// The per-particle updates go through Particle, so they round exactly like the AoS path
+inline void ParticleRef::update(float deltaTime) {
+    Particle particle = *this;
+    particle.update(deltaTime);
+    setPosition(particle.getPosition());
+    setVelocity(particle.getVelocity());
+}
+
+inline void ParticleRef::CollsionResponse(float m2, glm::vec2 v2, glm::vec2 p2, float deltaTime) {
+    Particle particle = *this;
+    particle.CollsionResponse(m2, v2, p2, deltaTime);
+    setPosition(particle.getPosition());
+    setVelocity(particle.getVelocity());
+}
+
+inline ParticleRef::operator Particle() const {
+    return static_cast<const ParticleSystem&>(system)[index];
+}
+
+inline ParticleRef& ParticleRef::operator=(const Particle& particle) {
+    system.mass[index] = particle.getMass();
+    system.invMass[index] = particle.getMass() > 0.0f ? 1.0f / particle.getMass() : 0.0f;
+    setPosition(particle.getPosition());
+    setVelocity(particle.getVelocity());
+    return *this;
+}
+
+#endif
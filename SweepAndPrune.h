@@ -0,0 +1,177 @@
+#ifndef SWEEP_AND_PRUNE_H
+#define SWEEP_AND_PRUNE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "ParticleSystem.h"
+#include "ParticleKernels.h"
+#include "BVH.h"
+#include "FrameArena.h"
+#include "PairMap.h"
+
+// Incremental sweep-and-prune broadphase.
+// The min/max endpoints of every particle box are kept sorted per axis between steps and
+// re-sorted with insertion sort, which is close to linear when particles move little.
+// Every swap of a min past a max endpoint is an event that adds or removes a pair from the
+// persistent overlap set, so the cost of a step grows with the motion rather than with N log N.
+
+class SweepAndPrune {
+public:
+    struct Endpoint {
+        float value;
+        uint32_t data; // Proxy index << 1, low bit set for max endpoints
+
+        uint32_t proxy() const { return data >> 1; }
+        bool isMax() const { return (data & 1) != 0; }
+    };
+
+    std::vector<AABB> boxes;              // Current box of every particle
+    std::vector<Endpoint> endpoints[2];   // Sorted endpoints along x and y
+    PairMap<bool> overlaps;               // Overlapping pairs, keyed by pairKey(i, j); the values are unused
+
+    SweepAndPrune() : maxExtentX(0.0f) {}
+
+    static uint64_t pairKey(uint32_t i, uint32_t j) {
+        return PairMap<bool>::pairKey(i, j);
+    }
+
+    // Brings endpoints and overlaps up to date with the particle positions.
+    // A change in the particle count resets everything with a full sort.
+    void update(const ParticleSystem& particles) {
+        if (particles.size() != boxes.size()) {
+            reset(particles);
+            return;
+        }
+
+        maxExtentX = 0.0f;
+        for (size_t i = 0; i < particles.size(); ++i) {
+            boxes[i] = BVH::particleAABB(particles.position(i));
+            maxExtentX = std::max(maxExtentX, boxes[i].maxX - boxes[i].minX);
+        }
+        for (int axis = 0; axis < 2; ++axis) {
+            for (Endpoint& endpoint : endpoints[axis]) {
+                endpoint.value = endpointValue(endpoint, axis);
+            }
+            insertionSort(axis);
+        }
+    }
+
+    void updateParticles(ParticleSystem& particles, float deltaTime) {
+        integrateParticles(particles, deltaTime);
+        update(particles);
+    }
+
+    // Copies the persistent overlap set into pairs as (i, j) with i < j
+    void findOverlappingPairs(std::vector<std::pair<int, int>>& pairs) const {
+        pairs.clear();
+        for (const auto& entry : overlaps.entries) {
+            uint64_t key = entry.key;
+            pairs.emplace_back(static_cast<int>(key >> 32), static_cast<int>(key & 0xFFFFFFFFu));
+        }
+    }
+
+    // Calls visitor(particleIndex) for every particle whose box overlaps queryBounds.
+    // Boxes are at most maxExtentX wide, so only min endpoints in
+    // [queryBounds.minX - maxExtentX, queryBounds.maxX] need to be checked.
+    template <typename Visitor>
+    void query(const AABB& queryBounds, Visitor&& visitor) const {
+        const std::vector<Endpoint>& sweep = endpoints[0];
+        auto it = std::lower_bound(sweep.begin(), sweep.end(), queryBounds.minX - maxExtentX,
+                                   [](const Endpoint& endpoint, float value) {
+                                       return endpoint.value < value;
+                                   });
+        for (; it != sweep.end() && it->value <= queryBounds.maxX; ++it) {
+            if (!it->isMax() && boxes[it->proxy()].overlaps(queryBounds)) {
+                visitor(static_cast<int>(it->proxy()));
+            }
+        }
+    }
+
+private:
+    float maxExtentX; // Widest box along the sweep axis
+
+    float endpointValue(const Endpoint& endpoint, int axis) const {
+        const AABB& box = boxes[endpoint.proxy()];
+        if (axis == 0) {
+            return endpoint.isMax() ? box.maxX : box.minX;
+        }
+        return endpoint.isMax() ? box.maxY : box.minY;
+    }
+
+    // Sort order: by value, with min endpoints first on ties so touching boxes overlap,
+    // matching AABB::overlaps
+    static bool before(const Endpoint& a, const Endpoint& b) {
+        return a.value < b.value || (a.value == b.value && !a.isMax() && b.isMax());
+    }
+
+    void insertionSort(int axis) {
+        std::vector<Endpoint>& sweep = endpoints[axis];
+        for (size_t k = 1; k < sweep.size(); ++k) {
+            Endpoint moving = sweep[k];
+            size_t j = k;
+            while (j > 0 && before(moving, sweep[j - 1])) {
+                const Endpoint& passed = sweep[j - 1];
+                if (!moving.isMax() && passed.isMax()) {
+                    // A min moved below another box's max: the boxes may start to overlap
+                    uint32_t a = moving.proxy();
+                    uint32_t b = passed.proxy();
+                    if (boxes[a].overlaps(boxes[b])) {
+                        overlaps.insert(pairKey(a, b));
+                    }
+                } else if (moving.isMax() && !passed.isMax()) {
+                    // A max moved below another box's min: the boxes separated on this axis
+                    overlaps.erase(pairKey(moving.proxy(), passed.proxy()));
+                }
+                sweep[j] = sweep[j - 1];
+                --j;
+            }
+            sweep[j] = moving;
+        }
+    }
+
+    void reset(const ParticleSystem& particles) {
+        const size_t count = particles.size();
+        boxes.resize(count);
+        overlaps.clear();
+        maxExtentX = 0.0f;
+        for (size_t i = 0; i < count; ++i) {
+            boxes[i] = BVH::particleAABB(particles.position(i));
+            maxExtentX = std::max(maxExtentX, boxes[i].maxX - boxes[i].minX);
+        }
+
+        for (int axis = 0; axis < 2; ++axis) {
+            std::vector<Endpoint>& sweep = endpoints[axis];
+            sweep.resize(2 * count);
+            for (size_t i = 0; i < count; ++i) {
+                sweep[2 * i].data = static_cast<uint32_t>(i << 1);
+                sweep[2 * i + 1].data = static_cast<uint32_t>((i << 1) | 1);
+            }
+            for (Endpoint& endpoint : sweep) {
+                endpoint.value = endpointValue(endpoint, axis);
+            }
+            std::sort(sweep.begin(), sweep.end(), before);
+        }
+
+        // Initial overlaps from one sweep along x, checking y directly
+        FrameArena& arena = threadFrameArena();
+        ArenaScope scope(arena);
+        FrameVector<uint32_t> active{ ArenaAllocator<uint32_t>(arena) };
+        for (const Endpoint& endpoint : endpoints[0]) {
+            uint32_t proxy = endpoint.proxy();
+            if (endpoint.isMax()) {
+                active.erase(std::find(active.begin(), active.end(), proxy));
+                continue;
+            }
+            for (uint32_t other : active) {
+                if (boxes[proxy].overlaps(boxes[other])) {
+                    overlaps.insert(pairKey(proxy, other));
+                }
+            }
+            active.push_back(proxy);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef UNIFORM_GRID_H
+#define UNIFORM_GRID_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <utility>
+#include <vector>
+#include "ParticleSystem.h"
+#include "ParticleKernels.h"
+#include "BVH.h"
+#include "CellGrid.h"
+
+// Uniform grid broadphase for equally sized particles.
+// Particle centers are binned into the square cells of a CellGrid, so every cell owns a
+// contiguous run of sortedIndices described by cellStart/cellCount.
+
+class UniformGrid : public CellGrid {
+public:
+    UniformGrid(float cellSize = 0.1f) : CellGrid(cellSize) {}
+
+    void build(const ParticleSystem& particles) {
+        const size_t count = particles.size();
+        if (count == 0) {
+            clear();
+            return;
+        }
+
+        // Fit the grid to the particles, coarsening it if they are spread over too many cells
+        glm::vec2 minPos = particles.position(0);
+        glm::vec2 maxPos = minPos;
+        for (size_t i = 0; i < count; ++i) {
+            minPos = glm::min(minPos, particles.position(i));
+            maxPos = glm::max(maxPos, particles.position(i));
+        }
+        fit(minPos, maxPos, std::max<size_t>(1024, 4 * count));
+
+        sortedIndices.resize(count);
+        std::iota(sortedIndices.begin(), sortedIndices.end(), 0u);
+        sort([&particles](uint32_t i) { return particles.position(i); });
+    }
+
+    void updateParticles(ParticleSystem& particles, float deltaTime) {
+        integrateParticles(particles, deltaTime);
+        build(particles);
+    }
+
+    // Calls visitor(particleIndex) for every particle whose center lies inside queryBounds
+    template <typename Visitor>
+    void query(const AABB& queryBounds, Visitor&& visitor) const {
+        forEachSlot(queryBounds.minX, queryBounds.minY, queryBounds.maxX, queryBounds.maxY, [&](uint32_t slot) {
+            const glm::vec2& pos = sortedPositions[slot];
+            if (pos.x >= queryBounds.minX && pos.x <= queryBounds.maxX &&
+                pos.y >= queryBounds.minY && pos.y <= queryBounds.maxY) {
+                visitor(static_cast<int>(sortedIndices[slot]));
+            }
+        });
+    }
+
+    // Collects every pair of particles whose centers are closer than cellSize on both axes
+    // as (i, j) with i < j, each pair once. pairs is cleared and refilled.
+    void findOverlappingPairs(std::vector<std::pair<int, int>>& pairs) const {
+        pairs.clear();
+        forEachNeighborSlotPair([&](uint32_t s, uint32_t t) {
+            testPair(s, t, pairs);
+        });
+    }
+
+private:
+    void testPair(uint32_t s, uint32_t t, std::vector<std::pair<int, int>>& pairs) const {
+        glm::vec2 delta = sortedPositions[s] - sortedPositions[t];
+        if (std::abs(delta.x) < cellSize && std::abs(delta.y) < cellSize) {
+            int i = static_cast<int>(sortedIndices[s]);
+            int j = static_cast<int>(sortedIndices[t]);
+            pairs.emplace_back(std::min(i, j), std::max(i, j));
+        }
+    }
+};
+
+#endif
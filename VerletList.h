@@ -0,0 +1,113 @@
+#ifndef VERLET_LIST_H
+#define VERLET_LIST_H
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "ParticleSystem.h"
+#include "ParticleKernels.h"
+#include "UniformGrid.h"
+
+// Verlet neighbor lists for equally sized particles.
+// Every particle lists the particles within cutoff + skin of it, found with a uniform grid.
+// Two particles close in by at most twice the largest displacement since the build, so
+// the lists hold every pair within cutoff until some particle has moved more than skin / 2,
+// and only then are they rebuilt.
+
+class VerletList {
+public:
+    float cutoff; // Interaction distance, the particle diameter by default
+    float skin;   // Extra distance that lets the lists survive several steps
+
+    // Neighbors in CSR form: the neighbors of particle i with a larger index are
+    // neighbors[neighborStart[i]] .. neighbors[neighborStart[i + 1] - 1], so each pair is stored once
+    std::vector<uint32_t> neighborStart;
+    std::vector<uint32_t> neighbors;
+
+    size_t buildCount;     // Number of list builds so far
+    size_t stepsSinceBuild; // Updates served by the current lists
+
+    VerletList(float cutoff = 0.1f, float skin = 0.05f)
+        : cutoff(cutoff), skin(skin), buildCount(0), stepsSinceBuild(0), grid(cutoff + skin) {}
+
+    // Rebuilds the lists if a particle moved more than skin / 2 since the last build.
+    // Returns true if they were rebuilt.
+    bool update(const ParticleSystem& particles) {
+        if (particles.size() != referencePositions.size() ||
+            maxDisplacementSquared(particles) > 0.25f * skin * skin) {
+            build(particles);
+            return true;
+        }
+        ++stepsSinceBuild;
+        return false;
+    }
+
+    void updateParticles(ParticleSystem& particles, float deltaTime) {
+        integrateParticles(particles, deltaTime);
+        update(particles);
+    }
+
+    void build(const ParticleSystem& particles) {
+        const size_t count = particles.size();
+        const float range = cutoff + skin;
+        grid.cellSize = range;
+        grid.build(particles);
+        grid.findOverlappingPairs(gridPairs);
+
+        // Counting sort of the pairs within range by their smaller index
+        neighborStart.assign(count + 1, 0);
+        size_t kept = 0;
+        for (const auto& pair : gridPairs) {
+            glm::vec2 delta = particles.position(pair.first) - particles.position(pair.second);
+            if (glm::dot(delta, delta) < range * range) {
+                ++neighborStart[pair.first + 1];
+                gridPairs[kept++] = pair;
+            }
+        }
+        gridPairs.resize(kept);
+        for (size_t i = 0; i < count; ++i) {
+            neighborStart[i + 1] += neighborStart[i];
+        }
+        neighbors.resize(kept);
+        fillCursor.assign(neighborStart.begin(), neighborStart.end() - 1);
+        for (const auto& pair : gridPairs) {
+            neighbors[fillCursor[pair.first]++] = static_cast<uint32_t>(pair.second);
+        }
+
+        referencePositions.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            referencePositions[i] = particles.position(i);
+        }
+        ++buildCount;
+        stepsSinceBuild = 0;
+    }
+
+    // Emits every listed pair as (i, j) with i < j. The pairs are within cutoff + skin at the
+    // last build, a superset of the pairs within cutoff now. pairs is cleared and refilled.
+    void findOverlappingPairs(std::vector<std::pair<int, int>>& pairs) const {
+        pairs.clear();
+        for (size_t i = 0; i + 1 < neighborStart.size(); ++i) {
+            for (uint32_t k = neighborStart[i]; k < neighborStart[i + 1]; ++k) {
+                pairs.emplace_back(static_cast<int>(i), static_cast<int>(neighbors[k]));
+            }
+        }
+    }
+
+    float maxDisplacementSquared(const ParticleSystem& particles) const {
+        float maxSquared = 0.0f;
+        for (size_t i = 0; i < particles.size(); ++i) {
+            glm::vec2 delta = particles.position(i) - referencePositions[i];
+            maxSquared = std::max(maxSquared, glm::dot(delta, delta));
+        }
+        return maxSquared;
+    }
+
+private:
+    UniformGrid grid;
+    std::vector<glm::vec2> referencePositions; // Positions at the last build
+    std::vector<std::pair<int, int>> gridPairs;
+    std::vector<uint32_t> fillCursor;
+};
+
+#endif
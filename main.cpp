@@ -5,19 +5,51 @@
 #include <glm/glm.hpp>
 #include <algorithm>
 #include <limits>
+#include <memory>
 #include "particle.h"  // Include the Particle class header
-#include "BVH.h"
+#include "ParticleSystem.h"
+#include "Broadphase.h"
+#include "FrameArena.h"
+#include "PairCache.h"
+
+#ifdef CHECK_STEP_ALLOCATIONS
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Test mode: count every global heap allocation so main can check that step() makes none
+static std::atomic<size_t> heapAllocations(0);
+
+void* operator new(size_t size) {
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* memory = std::malloc(size ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    std::free(memory);
+}
+#endif
 
 const int WINDOW_WIDTH = 800;
 const int WINDOW_HEIGHT = 600;
 // const float GRAVITY = -9.8f; // Gravity force
 const float radius = 0.05f; // Radius of cirlce
 
+// Broadphase used to find candidate collision pairs
+const BroadphaseType broadphaseType = BroadphaseType::Tree;
+
 // Global Particle instance
 // Position of x and y can not reach threshold of 0.94
 
 // Defining Particles
-std::vector<Particle> particles = {
+const std::vector<Particle> initialParticles = {
         Particle(1.0f, glm::vec2(0.0f, 0.0f), glm::vec2(0.1f, 0.1f)),
         Particle(1.0f, glm::vec2(0.83f, -0.63f), glm::vec2(-0.1f, -0.1f)),
         Particle(1.0f, glm::vec2(-0.51f, 0.55f), glm::vec2(0.2f, 0.2f)),
@@ -27,6 +59,14 @@ std::vector<Particle> particles = {
         Particle(1.0f, glm::vec2(-0.50f, 0.55f), glm::vec2(0.2f, 0.2f)),
         Particle(1.0f, glm::vec2(0.13f, 0.2f), glm::vec2(-0.2f, -0.2f))
 };
+
+// Simulated particles, one array per attribute, filled from initialParticles in main
+ParticleSystem particles;
+
+// Candidate collision pairs from the broadphase, reused across frames
+std::vector<std::pair<int, int>> candidatePairs;
+// Contact state of the candidate pairs, kept across frames
+PairCache contactCache;
 // Get distance
 
 float distance(float x1, float x2, float y1, float y2){
@@ -35,9 +75,10 @@ float distance(float x1, float x2, float y1, float y2){
 }
 
 // OpenGL Render function
-void render(std::vector<Particle> par) {
+void render(const ParticleSystem& par) {
     glClear(GL_COLOR_BUFFER_BIT);
-    for(Particle& p : par){
+    for(size_t index = 0; index < par.size(); ++index){
+        glm::vec2 center = par.position(index);
         // glClear(GL_COLOR_BUFFER_BIT);
 
         // Set the circle's color
@@ -45,11 +86,11 @@ void render(std::vector<Particle> par) {
 
         // Begin drawing the circle
         glBegin(GL_TRIANGLE_FAN);
-        glVertex2f(p.getPosition().x, p.getPosition().y); // Center of circle
+        glVertex2f(center.x, center.y); // Center of circle
         for (int i = 0; i <= 100; i++) {
             float angle = i * 2.0f * M_PI / 100;
-            float x = p.getPosition().x + radius * cos(angle);
-            float y = p.getPosition().y + radius * sin(angle);
+            float x = center.x + radius * cos(angle);
+            float y = center.y + radius * sin(angle);
             glVertex2f(x, y);
         }
         glEnd();
@@ -59,14 +100,13 @@ void render(std::vector<Particle> par) {
     glfwSwapBuffers(glfwGetCurrentContext());
 }
 
-// Update and render simulation
-void updateAndRender(std::vector<Particle> par, BVH bvh) {
-    float deltaTime = 0.016f;  // Assuming 60fps, so 1/60 = 0.016s per frame
+// Advances the simulation by one step: integration, broadphase and narrowphase
+void step(Broadphase& broadphase, float deltaTime) {
     /*
 	const float minX = -0.94f, maxX = 0.94f;
     const float minY = -0.94f, maxY = 0.94f;
     */
-    bvh.updateParticles(particles, deltaTime);
+    broadphase.updateParticles(particles, deltaTime);
     /*
     // Handle boundary collisions
     for (auto& particle : particles) {
@@ -104,49 +144,89 @@ void updateAndRender(std::vector<Particle> par, BVH bvh) {
     */
 
         // Detect and resolve collisions between particles
-    for (size_t i = 0; i < particles.size(); ++i) {
-        AABB queryBounds(
-            particles[i].getPosition().x - 0.1f, particles[i].getPosition().y - 0.1f,
-            particles[i].getPosition().x + 0.1f, particles[i].getPosition().y + 0.1f
-        );
-
-        std::vector<int> results = bvh.query(queryBounds);
-
-        for (int j : results) {
-            if (i != j) { // Avoid self-collision
-                glm::vec2 p1 = particles[i].getPosition();
-                glm::vec2 p2 = particles[j].getPosition();
-
-                float distance = glm::length(p1 - p2);
-                float minDistance = 0.1f; // Diameter of the particle (2 * radius)
-
-                if (distance < minDistance) {
-                        // Resolve collision using Particle's collision response
-                    particles[i].CollsionResponse(
-                        particles[j].getMass(),
-                        particles[j].getVelocity(),
-                        particles[j].getPosition(),
-                        deltaTime
-                    );
-
-                    particles[j].CollsionResponse(
-                        particles[i].getMass(),
-                        particles[i].getVelocity(),
-                        particles[i].getPosition(),
-                        deltaTime
-                    );
-                }
+    // Every candidate pair (i, j) with i < j is reported once by the broadphase
+    broadphase.findOverlappingPairs(candidatePairs);
+
+    contactCache.beginFrame();
+    for (const auto& pair : candidatePairs) {
+        int i = pair.first;
+        int j = pair.second;
+        glm::vec2 p1 = particles[i].getPosition();
+        glm::vec2 p2 = particles[j].getPosition();
+
+        // Pairs that were apart last time and barely moved since are still apart
+        PairCache::Contact& contact = contactCache.touch(i, j);
+        glm::vec2 offset = p1 - p2;
+        if (contact.canSkip(offset)) {
+            continue;
+        }
+
+        float distance = glm::length(offset);
+        float minDistance = 0.1f; // Diameter of the particle (2 * radius)
+        contact.record(offset, distance - minDistance);
+
+        if (distance < minDistance) {
+            glm::vec2 velocityBefore = particles[i].getVelocity();
+                // Resolve collision using Particle's collision response
+            particles[i].CollsionResponse(
+                particles[j].getMass(),
+                particles[j].getVelocity(),
+                particles[j].getPosition(),
+                deltaTime
+            );
+
+            particles[j].CollsionResponse(
+                particles[i].getMass(),
+                particles[i].getVelocity(),
+                particles[i].getPosition(),
+                deltaTime
+            );
+
+            contact.impulse = particles[i].getMass() * glm::length(particles[i].getVelocity() - velocityBefore);
+            if (distance > 0.0f) {
+                contact.normal = offset / distance;
             }
         }
     }
+    contactCache.endFrame();
+
+    // Scratch taken from the frame arena during the step is released in one go
+    threadFrameArena().reset();
+}
+
+// Update and render simulation
+void updateAndRender(const ParticleSystem& par, Broadphase& broadphase) {
+    float deltaTime = 0.016f;  // Assuming 60fps, so 1/60 = 0.016s per frame
+    step(broadphase, deltaTime);
     // Render the updated particle
     render(par);
-    
 }
 
 int main() {
-    BVH bvh;
-    bvh.build(particles);
+    particles.assign(initialParticles);
+    std::unique_ptr<Broadphase> broadphase = createBroadphase(broadphaseType, radius);
+    broadphase->build(particles);
+
+#ifdef CHECK_STEP_ALLOCATIONS
+    // Once a warm-up has grown every buffer to its working size, a step must not touch the heap
+    const int warmupSteps = 200;
+    const int checkedSteps = 2000;
+    for (int i = 0; i < warmupSteps; ++i) {
+        step(*broadphase, 0.016f);
+    }
+    for (int i = 0; i < checkedSteps; ++i) {
+        size_t before = heapAllocations.load();
+        step(*broadphase, 0.016f);
+        size_t allocations = heapAllocations.load() - before;
+        if (allocations != 0) {
+            std::cerr << "Step " << warmupSteps + i << " made " << allocations << " heap allocations" << std::endl;
+            return 1;
+        }
+    }
+    std::cout << "No heap allocations in " << checkedSteps << " steps" << std::endl;
+    return 0;
+#endif
+
     // Initialize GLFW
     if (!glfwInit()) {
         std::cerr << "Failed to initialize GLFW" << std::endl;
@@ -170,7 +250,7 @@ int main() {
     // Main loop
     while (!glfwWindowShouldClose(window)) {
         // Update and render simulation
-        updateAndRender(particles, bvh);
+        updateAndRender(particles, *broadphase);
         // updateAndRender(particle2);
 
         // Poll for events (e.g., window close)
@@ -1,6 +1,7 @@
 #ifndef PARTICLE_H
 #define PARTICLE_H
 
+#include <vector>
 #include <glm/glm.hpp>
 
 class Particle {
@@ -8,44 +9,19 @@ class Particle {
     // Attributes of a particle
     float mass;
     glm::vec2 position;
-    glm::vec2 accelaration;
-    glm::vec2 force;
     glm::vec2 velocity;
 
 
     // Constructor
     Particle(float mass, const glm::vec2 position = glm::vec2(0.0f), const glm::vec2 velocity = glm::vec2(0.0f))
-    : mass(mass), position(position), velocity(velocity), accelaration(0.0f), force(0.0f) {}
-
-    // Apply force to Particle
-    // Useful to simulate gravity
-
-    void ApplyForce(const glm::vec2 forceToApply) {
-        this->force += forceToApply;
-    }
+    : mass(mass), position(position), velocity(velocity) {}
 
     // Update particle state
+    // No forces act on the particles, so the velocity only changes in collisions
 
     void update(float deltaTime){
-        if (mass > 0.0f){
-            // compute accelaration
-            // accelaration = force / mass;
-            accelaration = glm::vec2(0.0f);
-        } else {
-            accelaration = glm::vec2(0.0f);
-        }
-    
-
-        // update velocity v = v0 + a * dt
-        velocity += accelaration * deltaTime;
-
         // update position: p = = p0 + v * dt
         position += velocity * deltaTime;
-
-
-        // reset accumulated force for next frame
-
-        force = glm::vec2(0.0f);
     }
 
     // Getter functions 
@@ -58,10 +34,6 @@ class Particle {
         return velocity;
     }
 
-    glm::vec2 getAcceleration() const {
-        return accelaration;
-    }
-
     float getMass() const {
         return mass;
     }
@@ -108,4 +80,47 @@ class Particle {
     }
 };
 
+// Advances every particle by deltaTime and reflects it off the walls of the box
+inline void integrateParticles(std::vector<Particle>& particles, float deltaTime) {
+    for (auto& particle : particles) {
+        particle.update(deltaTime);
+
+        bool hitX = false, hitY = false;
+        glm::vec2 pos = particle.getPosition();
+        glm::vec2 velocity = particle.getVelocity();
+        const float minX = -0.94f, maxX = 0.94f;
+        const float minY = -0.94f, maxY = 0.94f;
+
+        // Check collisions with vertical boundaries
+        if (pos.x < minX) {
+            pos.x = minX;
+            velocity.x = -velocity.x * 0.9f; // Reflect and dampen
+            hitX = true;
+        } else if (pos.x > maxX) {
+            pos.x = maxX;
+            velocity.x = -velocity.x * 0.9f;
+            hitX = true;
+        }
+
+        // Check collisions with horizontal boundaries
+        if (pos.y < minY) {
+            pos.y = minY;
+            velocity.y = -velocity.y * 0.9f;
+            hitY = true;
+        } else if (pos.y > maxY) {
+            pos.y = maxY;
+            velocity.y = -velocity.y * 0.9f;
+            hitY = true;
+        }
+
+        // Handle corner cases: dampen velocity slightly if both axes collide
+        if (hitX && hitY) {
+            velocity *= 0.9f; // Extra damping to resolve sticking
+        }
+
+        particle.position = pos;
+        particle.velocity = velocity;
+    }
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,149 @@
+// Checks every BVH builder and node layout against brute force: the self-collision pairs and
+// box queries after the build, after refits and after switching layout, on uniform, clustered
+// and coincident particles. Returns nonzero on failure.
+// Build from the repo root:
+//   clang++ -std=c++17 -Wall -O2 -I. -Idependencies/include tests/BVHTests.cpp -o bvh_tests
+
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <set>
+#include <utility>
+#include <vector>
+#include "ParticleSystem.h"
+#include "BVH.h"
+
+static int failures = 0;
+
+static void fail(const char* what, const char* label) {
+    if (failures++ < 20) {
+        std::printf("FAIL %s: %s\n", label, what);
+    }
+}
+
+// Every pair (i, j), i < j, whose particle boxes overlap
+static std::set<std::pair<int, int>> bruteForcePairs(const ParticleSystem& particles) {
+    std::set<std::pair<int, int>> pairs;
+    for (size_t i = 0; i < particles.size(); ++i) {
+        AABB box = BVH::particleAABB(particles.position(i));
+        for (size_t j = i + 1; j < particles.size(); ++j) {
+            if (box.overlaps(BVH::particleAABB(particles.position(j)))) {
+                pairs.insert(std::make_pair(static_cast<int>(i), static_cast<int>(j)));
+            }
+        }
+    }
+    return pairs;
+}
+
+static void checkPairs(const BVH& bvh, const ParticleSystem& particles, const char* label) {
+    std::vector<std::pair<int, int>> pairs;
+    bvh.findOverlappingPairs(pairs);
+    std::set<std::pair<int, int>> found(pairs.begin(), pairs.end());
+    if (found.size() != pairs.size()) {
+        fail("pair reported twice", label);
+    }
+    if (found != bruteForcePairs(particles)) {
+        fail("pairs differ from brute force", label);
+    }
+}
+
+static void checkQuery(const BVH& bvh, const ParticleSystem& particles, const AABB& queryBounds, const char* label) {
+    std::multiset<int> found, expected;
+    bvh.query(queryBounds, [&found](int particleIndex) { found.insert(particleIndex); });
+    for (size_t i = 0; i < particles.size(); ++i) {
+        if (BVH::particleAABB(particles.position(i)).overlaps(queryBounds)) {
+            expected.insert(static_cast<int>(i));
+        }
+    }
+    if (found != expected) {
+        fail("query differs from brute force", label);
+    }
+}
+
+static void checkAll(const BVH& bvh, const ParticleSystem& particles, std::mt19937& rng, const char* label) {
+    checkPairs(bvh, particles, label);
+
+    std::uniform_real_distribution<float> corner(-1.2f, 1.2f), size(0.0f, 0.4f);
+    for (int q = 0; q < 20; ++q) {
+        float x = corner(rng), y = corner(rng);
+        checkQuery(bvh, particles, AABB(x, y, x + size(rng), y + size(rng)), label);
+    }
+    // Boxes covering whole quantized nodes, and unbounded ones, also overlap empty lanes
+    const float inf = std::numeric_limits<float>::infinity();
+    checkQuery(bvh, particles, AABB(-10.0f, -10.0f, 10.0f, 10.0f), label);
+    checkQuery(bvh, particles, AABB(-inf, -inf, inf, inf), label);
+    checkQuery(bvh, particles, AABB(-inf, -0.1f, inf, 0.1f), label);
+}
+
+enum class Distribution { Uniform, Clustered, Coincident };
+
+static ParticleSystem makeParticles(size_t count, Distribution distribution, std::mt19937& rng) {
+    std::uniform_real_distribution<float> uniform(-0.9f, 0.9f), cluster(0.2f, 0.3f), velocity(-1.0f, 1.0f);
+    ParticleSystem particles;
+    for (size_t i = 0; i < count; ++i) {
+        glm::vec2 position;
+        if (distribution == Distribution::Coincident) {
+            position = glm::vec2(0.25f, -0.5f);
+        } else if (distribution == Distribution::Clustered && i % 4 != 0) {
+            position = glm::vec2(cluster(rng), cluster(rng));
+        } else {
+            position = glm::vec2(uniform(rng), uniform(rng));
+        }
+        particles.push_back(Particle(1.0f, position, glm::vec2(velocity(rng), velocity(rng))));
+    }
+    return particles;
+}
+
+int main() {
+    const BuildStrategy strategies[] = { BuildStrategy::Median, BuildStrategy::LBVH, BuildStrategy::BinnedSAH };
+    const char* strategyNames[] = { "Median", "LBVH", "BinnedSAH" };
+    const NodeLayout layouts[] = { NodeLayout::Binary, NodeLayout::Wide4, NodeLayout::Quantized4 };
+    const char* layoutNames[] = { "Binary", "Wide4", "Quantized4" };
+    const Distribution distributions[] = { Distribution::Uniform, Distribution::Clustered, Distribution::Coincident };
+    const char* distributionNames[] = { "uniform", "clustered", "coincident" };
+
+    std::mt19937 rng(12345);
+    for (size_t count : { 0, 1, 2, 3, 5, 17, 100, 400 }) {
+        for (int d = 0; d < 3; ++d) {
+            if (distributions[d] == Distribution::Coincident && count > 100) {
+                continue; // Every pair overlaps, brute force dominates
+            }
+            for (int leafSize : { 1, 4, 8 }) {
+                for (int s = 0; s < 3; ++s) {
+                    for (int l = 0; l < 3; ++l) {
+                        char label[128];
+                        std::snprintf(label, sizeof(label), "%s %s, %zu %s particles, leaves of %d", strategyNames[s],
+                                      layoutNames[l], count, distributionNames[d], leafSize);
+
+                        ParticleSystem particles = makeParticles(count, distributions[d], rng);
+                        BVH bvh;
+                        bvh.strategy = strategies[s];
+                        bvh.layout = layouts[l];
+                        bvh.maxLeafSize = leafSize;
+                        bvh.build(particles);
+                        checkAll(bvh, particles, rng, label);
+
+                        // Refits, and rebuilds once the refitted tree degrades
+                        for (int step = 0; step < 5; ++step) {
+                            bvh.updateParticles(particles, 0.05f);
+                            checkAll(bvh, particles, rng, label);
+                        }
+
+                        // Every other layout over the same tree
+                        for (NodeLayout layout : layouts) {
+                            bvh.layout = layout;
+                            bvh.updateParticles(particles, 0.05f);
+                            checkAll(bvh, particles, rng, label);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if (failures == 0) {
+        std::printf("BVH pairs and queries match brute force\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,116 @@
+// Checks PairMap against std::map under random inserts, erases and erases by entry index, while
+// it grows through several capacities and shrinks back, so long probe runs are shifted back over
+// and over. Returns nonzero on failure.
+// Build from the repo root:
+//   clang++ -std=c++17 -Wall -O2 -I. tests/PairMapTests.cpp -o pair_map_tests
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <set>
+#include "PairMap.h"
+
+static int failures = 0;
+
+static void fail(const char* what, int round) {
+    if (failures++ < 20) {
+        std::printf("FAIL round %d: %s\n", round, what);
+    }
+}
+
+static void check(const PairMap<int>& map, const std::map<uint64_t, int>& reference, uint32_t keyRange, int round) {
+    if (map.size() != reference.size()) {
+        fail("size differs", round);
+    }
+    std::set<uint64_t> keys;
+    for (const auto& entry : map.entries) {
+        keys.insert(entry.key);
+        auto found = reference.find(entry.key);
+        if (found == reference.end() || found->second != entry.value) {
+            fail("entry not in the reference", round);
+        }
+    }
+    if (keys.size() != map.entries.size()) {
+        fail("key stored twice", round);
+    }
+    // Every key in range, present or not, must be found exactly when the reference holds it
+    for (uint32_t i = 0; i < keyRange; ++i) {
+        for (uint32_t j = i + 1; j < keyRange; ++j) {
+            uint64_t key = PairMap<int>::pairKey(i, j);
+            const int* value = map.find(key);
+            auto found = reference.find(key);
+            if (found == reference.end() ? value != nullptr : (value == nullptr || *value != found->second)) {
+                fail("find differs from the reference", round);
+            }
+        }
+    }
+}
+
+int main() {
+    if (PairMap<int>::pairKey(3, 7) != PairMap<int>::pairKey(7, 3) || PairMap<int>::pairKey(3, 7) != ((3ull << 32) | 7)) {
+        fail("pairKey is not (min, max)", 0);
+    }
+
+    const uint32_t keyRange = 100; // 4950 distinct pairs
+    std::mt19937 rng(2024);
+    std::uniform_int_distribution<uint32_t> particle(0, keyRange - 1);
+    std::uniform_int_distribution<int> operation(0, 9);
+    PairMap<int> map;
+    std::map<uint64_t, int> reference;
+
+    for (int round = 1; round <= 60; ++round) {
+        // Fill towards a target that rises and falls, then hover around it
+        int phase = round % 20;
+        size_t target = phase < 10 ? static_cast<size_t>(phase) * 400 : static_cast<size_t>(20 - phase) * 400;
+        for (int op = 0; op < 2000; ++op) {
+            uint32_t i = particle(rng), j = particle(rng);
+            if (i == j) {
+                continue;
+            }
+            uint64_t key = PairMap<int>::pairKey(i, j);
+            bool grow = map.size() < target ? operation(rng) < 8 : operation(rng) < 2;
+            if (grow) {
+                auto inserted = map.insert(key);
+                if (inserted.second != (reference.count(key) == 0)) {
+                    fail("insert reported the wrong novelty", round);
+                }
+                if (inserted.second && *inserted.first != 0) {
+                    fail("inserted value not value-initialized", round);
+                }
+                *inserted.first = op;
+                reference[key] = op;
+            } else if (operation(rng) < 5 && map.size() > 0) {
+                size_t index = std::uniform_int_distribution<size_t>(0, map.size() - 1)(rng);
+                reference.erase(map.entries[index].key);
+                map.eraseEntry(index);
+            } else if (map.erase(key) != (reference.erase(key) == 1)) {
+                fail("erase reported the wrong result", round);
+            }
+        }
+        check(map, reference, keyRange, round);
+    }
+
+    // Empty everything through erase, then reuse the map after clear
+    while (!reference.empty()) {
+        uint64_t key = reference.begin()->first;
+        reference.erase(reference.begin());
+        if (!map.erase(key)) {
+            fail("erase missed a present key", 61);
+        }
+    }
+    check(map, reference, keyRange, 61);
+    for (uint32_t i = 1; i < keyRange; ++i) {
+        *map.insert(PairMap<int>::pairKey(0, i)).first = static_cast<int>(i);
+        reference[PairMap<int>::pairKey(0, i)] = static_cast<int>(i);
+    }
+    check(map, reference, keyRange, 62);
+    map.clear();
+    reference.clear();
+    check(map, reference, keyRange, 63);
+
+    if (failures == 0) {
+        std::printf("PairMap matches std::map\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,112 @@
+// Checks every SIMD integration kernel the CPU supports against integrateParticles for
+// std::vector<Particle>, bit for bit, on random particles and on signed zeros, infinities, NaNs,
+// walls and corners. Returns nonzero on failure.
+// The AoS reference follows the build flags, so build without contraction, from the repo root:
+//   clang++ -std=c++17 -Wall -O2 -ffp-contract=off -I. -Idependencies/include tests/ParticleKernelTests.cpp -o kernel_tests
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+#include "particle.h"
+#include "ParticleSystem.h"
+#include "ParticleKernels.h"
+
+static int failures = 0;
+
+static uint32_t bits(float value) {
+    uint32_t result;
+    std::memcpy(&result, &value, sizeof(result));
+    return result;
+}
+
+// Same bits, or both NaN: the sign and payload of a NaN are not part of the contract
+static bool sameFloat(float a, float b) {
+    return bits(a) == bits(b) || (std::isnan(a) && std::isnan(b));
+}
+
+static std::vector<Particle> specialParticles() {
+    const float inf = std::numeric_limits<float>::infinity();
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    std::vector<Particle> particles;
+    particles.push_back(Particle(1.0f, glm::vec2(0.0f, 0.0f), glm::vec2(-0.0f, -0.0f)));
+    particles.push_back(Particle(1.0f, glm::vec2(-0.0f, 0.5f), glm::vec2(0.0f, -0.0f)));
+    particles.push_back(Particle(1.0f, glm::vec2(0.94f, -0.94f), glm::vec2(-0.0f, 0.0f))); // Resting on a corner
+    particles.push_back(Particle(1.0f, glm::vec2(0.94f, 0.0f), glm::vec2(0.0f, 0.0f)));
+    particles.push_back(Particle(1.0f, glm::vec2(0.939f, 0.939f), glm::vec2(5.0f, 5.0f)));     // Into a corner
+    particles.push_back(Particle(1.0f, glm::vec2(-0.939f, 0.2f), glm::vec2(-5.0f, 0.0f)));     // Into a wall
+    particles.push_back(Particle(1.0f, glm::vec2(0.1f, 0.2f), glm::vec2(inf, -inf)));
+    particles.push_back(Particle(1.0f, glm::vec2(inf, -inf), glm::vec2(1.0f, 1.0f)));
+    particles.push_back(Particle(1.0f, glm::vec2(0.3f, 0.3f), glm::vec2(nan, 1.0f)));
+    particles.push_back(Particle(1.0f, glm::vec2(nan, 0.3f), glm::vec2(0.0f, -0.0f)));
+    particles.push_back(Particle(1.0f, glm::vec2(2.0f, -3.0f), glm::vec2(0.0f, -0.0f)));      // Outside the box
+    return particles;
+}
+
+static std::vector<Particle> randomParticles(size_t count, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> position(-0.95f, 0.95f), velocity(-3.0f, 3.0f);
+    std::vector<Particle> particles;
+    for (size_t i = 0; i < count; ++i) {
+        particles.push_back(Particle(1.0f, glm::vec2(position(rng), position(rng)), glm::vec2(velocity(rng), velocity(rng))));
+    }
+    return particles;
+}
+
+static void checkLevel(SimdLevel level, const std::vector<Particle>& initial, const char* name) {
+    const int steps = 300;
+    const float deltaTime = 0.016f;
+
+    std::vector<Particle> reference = initial;
+    ParticleSystem system;
+    system.assign(initial);
+    particleSimdLevel() = level;
+    for (int step = 0; step < steps; ++step) {
+        integrateParticles(reference, deltaTime);
+        integrateParticles(system, deltaTime);
+    }
+
+    for (size_t i = 0; i < initial.size(); ++i) {
+        const Particle& expected = reference[i];
+        if (!sameFloat(system.posX[i], expected.position.x) || !sameFloat(system.posY[i], expected.position.y) ||
+            !sameFloat(system.velX[i], expected.velocity.x) || !sameFloat(system.velY[i], expected.velocity.y)) {
+            std::printf("FAIL %s, level %d, particle %zu: (%g, %g, %g, %g), expected (%g, %g, %g, %g)\n", name,
+                        static_cast<int>(level), i, system.posX[i], system.posY[i], system.velX[i], system.velY[i],
+                        expected.position.x, expected.position.y, expected.velocity.x, expected.velocity.y);
+            ++failures;
+            return;
+        }
+    }
+}
+
+int main() {
+    const SimdLevel detected = detectSimdLevel();
+    std::vector<std::vector<Particle>> cases;
+    cases.push_back(specialParticles());
+    for (size_t count : { 0, 1, 3, 7, 15, 17, 100, 1001 }) {
+        cases.push_back(randomParticles(count, static_cast<uint32_t>(count)));
+    }
+    std::vector<Particle> mixed = randomParticles(45, 7);
+    std::vector<Particle> special = specialParticles();
+    for (size_t i = 0; i < special.size(); ++i) {
+        mixed[4 * i] = special[i]; // Special values in every lane position
+    }
+    cases.push_back(mixed);
+
+    for (int level = 0; level <= static_cast<int>(detected); ++level) {
+        for (size_t c = 0; c < cases.size(); ++c) {
+            char name[32];
+            std::snprintf(name, sizeof(name), "case %zu", c);
+            checkLevel(static_cast<SimdLevel>(level), cases[c], name);
+        }
+    }
+    particleSimdLevel() = detected;
+
+    if (failures == 0) {
+        std::printf("Particle kernels match the AoS integration up to level %d\n", static_cast<int>(detected));
+    }
+    return failures == 0 ? 0 : 1;
+}
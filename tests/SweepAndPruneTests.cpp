@@ -0,0 +1,156 @@
+// Checks the incremental sweep-and-prune against brute force: after every step the persistent
+// overlap set must hold exactly the overlapping pairs, while particles drift, bounce off the
+// walls, jump, share coordinates and are added. Returns nonzero on failure.
+// Build from the repo root:
+//   clang++ -std=c++17 -Wall -O2 -I. -Idependencies/include tests/SweepAndPruneTests.cpp -o sweep_tests
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <set>
+#include <utility>
+#include <vector>
+#include "ParticleSystem.h"
+#include "SweepAndPrune.h"
+
+static int failures = 0;
+
+static void fail(const char* what, const char* label, int step) {
+    if (failures++ < 20) {
+        std::printf("FAIL %s, step %d: %s\n", label, step, what);
+    }
+}
+
+// Every pair (i, j), i < j, whose particle boxes overlap
+static std::set<std::pair<int, int>> bruteForcePairs(const ParticleSystem& particles) {
+    std::set<std::pair<int, int>> pairs;
+    for (size_t i = 0; i < particles.size(); ++i) {
+        AABB box = BVH::particleAABB(particles.position(i));
+        for (size_t j = i + 1; j < particles.size(); ++j) {
+            if (box.overlaps(BVH::particleAABB(particles.position(j)))) {
+                pairs.insert(std::make_pair(static_cast<int>(i), static_cast<int>(j)));
+            }
+        }
+    }
+    return pairs;
+}
+
+static void check(const SweepAndPrune& sweep, const ParticleSystem& particles, std::mt19937& rng, const char* label, int step) {
+    std::vector<std::pair<int, int>> pairs;
+    sweep.findOverlappingPairs(pairs);
+    std::set<std::pair<int, int>> found;
+    for (const auto& pair : pairs) {
+        if (pair.first >= pair.second) {
+            fail("pair not ordered i < j", label, step);
+        }
+        found.insert(pair);
+    }
+    if (found.size() != pairs.size()) {
+        fail("pair reported twice", label, step);
+    }
+    if (found != bruteForcePairs(particles)) {
+        fail("pairs differ from brute force", label, step);
+    }
+
+    std::uniform_real_distribution<float> corner(-1.2f, 1.2f), size(0.0f, 0.5f);
+    for (int q = 0; q < 10; ++q) {
+        float x = corner(rng), y = corner(rng);
+        AABB queryBounds(x, y, x + size(rng), y + size(rng));
+        std::multiset<int> hits, expected;
+        sweep.query(queryBounds, [&hits](int particleIndex) { hits.insert(particleIndex); });
+        for (size_t i = 0; i < particles.size(); ++i) {
+            if (BVH::particleAABB(particles.position(i)).overlaps(queryBounds)) {
+                expected.insert(static_cast<int>(i));
+            }
+        }
+        if (hits != expected) {
+            fail("query differs from brute force", label, step);
+        }
+    }
+}
+
+// Coordinates whose neighbouring boxes touch exactly: the max of one equals the min of the next
+static std::vector<float> touchingCoordinates() {
+    std::vector<float> coordinates(1, -0.8f);
+    while (coordinates.back() < 0.6f) {
+        float edge = coordinates.back() + 0.1f;
+        float next = edge + 0.1f;
+        while (next - 0.1f < edge) {
+            next = std::nextafter(next, 1.0f);
+        }
+        while (next - 0.1f > edge) {
+            next = std::nextafter(next, -1.0f);
+        }
+        if (next - 0.1f != edge) {
+            break;
+        }
+        coordinates.push_back(next);
+    }
+    return coordinates;
+}
+
+static void run(size_t count, bool snapped, float speed, uint32_t seed, const char* label) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> position(-0.9f, 0.9f), velocity(-speed, speed), unit(0.0f, 1.0f);
+    const std::vector<float> grid = touchingCoordinates();
+    std::uniform_int_distribution<int> gridIndex(0, static_cast<int>(grid.size()) - 1);
+    std::vector<int> cellX, cellY;
+    ParticleSystem particles;
+    for (size_t i = 0; i < count; ++i) {
+        glm::vec2 p(position(rng), position(rng));
+        if (snapped) {
+            cellX.push_back(gridIndex(rng));
+            cellY.push_back(gridIndex(rng));
+            p = glm::vec2(grid[cellX[i]], grid[cellY[i]]);
+        }
+        particles.push_back(Particle(1.0f, p, glm::vec2(velocity(rng), velocity(rng))));
+    }
+
+    SweepAndPrune sweep;
+    sweep.update(particles);
+    check(sweep, particles, rng, label, 0);
+
+    for (int step = 1; step <= 60; ++step) {
+        if (snapped) {
+            // Step along the grid so touching and coincident boxes keep appearing and separating
+            for (size_t i = 0; i < cellX.size(); ++i) {
+                if (unit(rng) < 0.3f) {
+                    cellX[i] = glm::clamp(cellX[i] + (unit(rng) < 0.5f ? 1 : -1), 0, static_cast<int>(grid.size()) - 1);
+                    cellY[i] = glm::clamp(cellY[i] + (unit(rng) < 0.5f ? 1 : -1), 0, static_cast<int>(grid.size()) - 1);
+                    particles.posX[i] = grid[cellX[i]];
+                    particles.posY[i] = grid[cellY[i]];
+                }
+            }
+            sweep.update(particles);
+        } else {
+            sweep.updateParticles(particles, 0.016f);
+        }
+
+        // A few particles jump across the box, passing many endpoints at once
+        if (step % 10 == 0 && !particles.empty()) {
+            size_t i = static_cast<size_t>(unit(rng) * particles.size()) % particles.size();
+            particles[i].setPosition(glm::vec2(-particles.posX[i], position(rng)));
+            sweep.update(particles);
+        }
+        // A new particle resets the sweep
+        if (step % 25 == 0) {
+            particles.push_back(Particle(1.0f, glm::vec2(position(rng), position(rng)), glm::vec2(velocity(rng), velocity(rng))));
+            sweep.update(particles);
+        }
+        check(sweep, particles, rng, label, step);
+    }
+}
+
+int main() {
+    run(0, false, 1.0f, 1, "empty");
+    run(1, false, 1.0f, 2, "single particle");
+    run(50, false, 1.0f, 3, "slow particles");
+    run(50, false, 20.0f, 4, "fast particles");
+    run(300, false, 2.0f, 5, "crowded particles");
+    run(200, true, 0.0f, 6, "particles on a grid");
+
+    if (failures == 0) {
+        std::printf("Sweep-and-prune pairs and queries match brute force\n");
+    }
+    return failures == 0 ? 0 : 1;
+}